@@ -0,0 +1,172 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+// CCB decode microbenchmark: feeds synthetic CCB1 and CCB2 frames     //
+// straight to the interpreter, no link involved. For comparison it    //
+// also times the block buffer on its own, against the vector that     //
+// erased its front block for every new block once full.                //
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "pixyinterpreter.hpp"
+
+#define DEFAULT_FRAMES  20000
+
+static double now_ns()
+{
+  return std::chrono::duration<double, std::nano>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A hint argument as Chirp deserializes it: the type byte right before //
+// the value, which is aligned.                                          //
+struct HintArgument
+{
+  uint8_t  padding[3];
+  uint8_t  type;
+  uint32_t value;
+};
+
+static BlobA normal_blobs[PIXY_BLOCK_CAPACITY];
+static BlobB color_code_blobs[PIXY_BLOCK_CAPACITY];
+
+static void make_blobs(uint16_t count)
+{
+  uint16_t index;
+
+  for (index = 0; index != count; ++index) {
+    normal_blobs[index]     = BlobA(index % 7 + 1, index, index + 20, index, index + 20);
+    color_code_blobs[index] = BlobB(012, index, index + 30, index, index + 30, index % 360 - 180);
+  }
+}
+
+static double decode(uint32_t fourcc, uint16_t blocks, uint32_t frames)
+{
+  PixyInterpreter pixy;
+  Interpreter &   interpreter = pixy;
+  HintArgument    hint;
+  uint32_t        normal_length;
+  uint32_t        color_code_length;
+  uint16_t        dimension;
+  const void *    arguments[8];
+  uint32_t        frame;
+  double          start;
+
+  hint.type  = CRP_TYPE_HINT;
+  hint.value = fourcc;
+  dimension  = 0;
+
+  // Array lengths are in uint16_t units //
+  normal_length     = blocks * sizeof(BlobA) / sizeof(uint16_t);
+  color_code_length = blocks * sizeof(BlobB) / sizeof(uint16_t);
+
+  arguments[0] = &hint.value;
+  arguments[1] = &dimension;
+  arguments[2] = &dimension;
+  arguments[3] = &dimension;
+  arguments[4] = &normal_length;
+  arguments[5] = normal_blobs;
+  arguments[6] = &color_code_length;
+  arguments[7] = color_code_blobs;
+
+  start = now_ns();
+
+  for (frame = 0; frame != frames; ++frame) {
+    interpreter.interpret_data(arguments);
+  }
+
+  return (now_ns() - start) / frames;
+}
+
+// The block buffer before the ring: a vector, front erased when full //
+static double vector_buffer(uint16_t blocks, uint32_t frames)
+{
+  std::vector<Block> buffer;
+  Block              block;
+  Block              copy[PIXY_BLOCK_CAPACITY];
+  uint32_t           frame;
+  uint16_t           index;
+  double             start;
+
+  memset(&block, 0, sizeof(block));
+
+  start = now_ns();
+
+  for (frame = 0; frame != frames; ++frame) {
+    for (index = 0; index != blocks; ++index) {
+      block.x = index;
+      if (buffer.size() == PIXY_BLOCK_CAPACITY) {
+        buffer.erase(buffer.begin());
+      }
+      buffer.push_back(block);
+    }
+    memcpy(copy, buffer.data(), buffer.size() * sizeof(Block));
+  }
+
+  return (now_ns() - start) / frames;
+}
+
+static double ring_buffer(uint16_t blocks, uint32_t frames)
+{
+  static RingBuffer<Block, PIXY_BLOCK_CAPACITY> buffer;
+  Block    block;
+  Block    copy[PIXY_BLOCK_CAPACITY];
+  uint32_t frame;
+  uint16_t index;
+  double   start;
+
+  memset(&block, 0, sizeof(block));
+  buffer.clear();
+
+  start = now_ns();
+
+  for (frame = 0; frame != frames; ++frame) {
+    for (index = 0; index != blocks; ++index) {
+      block.x = index;
+      buffer.push(block);
+    }
+    buffer.copy(copy);
+  }
+
+  return (now_ns() - start) / frames;
+}
+
+int main(int argc, char * argv[])
+{
+  uint16_t block_counts[] = { 10, 50, 100, 250 };
+  uint32_t frames;
+  size_t   index;
+
+  frames = argc > 1 ? atoi(argv[1]) : DEFAULT_FRAMES;
+
+  make_blobs(PIXY_BLOCK_CAPACITY);
+
+  printf("Per frame, %u frames each (CCB2: as many normal as color code blocks)\n", frames);
+  printf("%8s %12s %12s %14s %12s\n", "blocks", "CCB1 ns", "CCB2 ns", "vector buf ns", "ring buf ns");
+
+  for (index = 0; index != sizeof(block_counts) / sizeof(block_counts[0]); ++index) {
+    printf("%8u %12.0f %12.0f %14.0f %12.0f\n", block_counts[index],
+           decode(FOURCC('C', 'C', 'B', '1'), block_counts[index], frames),
+           decode(FOURCC('C', 'C', 'B', '2'), block_counts[index] / 2, frames),
+           vector_buffer(block_counts[index], frames),
+           ring_buffer(block_counts[index], frames));
+  }
+
+  return EXIT_SUCCESS;
+}
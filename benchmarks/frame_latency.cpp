@@ -0,0 +1,113 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+// End-to-end frame latency against the emulated Pixy: from the moment //
+// the emulator sends a frame until the frame callback sees it. Runs   //
+// the event-driven interpreter thread, and for comparison an inline   //
+// loop that polls like the interpreter thread used to: service, then  //
+// sleep 15 ms.                                                        //
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "pixyinterpreter.hpp"
+
+#define FRAME_RATE       50     // A frame every 20 ms, as Pixy sends them
+#define DEFAULT_FRAMES   250
+#define POLL_INTERVAL_US 15000
+
+static uint64_t now_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char * name, std::vector<uint64_t> & latencies)
+{
+  uint64_t total;
+  size_t   index;
+
+  if (latencies.empty()) {
+    printf("%-8s no frames\n", name);
+    return;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+
+  for (index = 0, total = 0; index != latencies.size(); ++index) {
+    total += latencies[index];
+  }
+
+  printf("%-8s frames %5zu  mean %7.3f ms  p50 %7.3f ms  p99 %7.3f ms  max %7.3f ms\n",
+         name, latencies.size(),
+         total / 1000.0 / latencies.size(),
+         latencies[latencies.size() / 2] / 1000.0,
+         latencies[latencies.size() * 99 / 100] / 1000.0,
+         latencies.back() / 1000.0);
+}
+
+static void run(const char * name, PixyThreading threading, size_t frames)
+{
+  PixyInterpreter       pixy;
+  std::vector<uint64_t> latencies;
+
+  latencies.reserve(frames);
+
+  if (pixy.init_emulated(FRAME_RATE, 5, 2, threading) < 0) {
+    fprintf(stderr, "%s: failed to open the emulated Pixy\n", name);
+    return;
+  }
+
+  PixyEmulator * emulator = pixy.emulator();
+
+  // Well within a frame period, so the latest frame sent is the one seen //
+  pixy.on_frame([&](const PixyFrameView &) {
+    if (latencies.size() < frames) {
+      latencies.push_back(now_us() - emulator->last_frame_time());
+    }
+  });
+
+  if (threading == PIXY_THREAD_NONE) {
+    while (latencies.size() < frames) {
+      pixy.service(0);
+      usleep(POLL_INTERVAL_US);
+    }
+  } else {
+    // Frame period is in ms //
+    usleep(frames * (1000 / FRAME_RATE) * 1000 + 100000);
+  }
+
+  pixy.on_frame(PixyInterpreter::FrameCallback());
+  pixy.close();
+
+  report(name, latencies);
+}
+
+int main(int argc, char * argv[])
+{
+  size_t frames;
+
+  frames = argc > 1 ? atoi(argv[1]) : DEFAULT_FRAMES;
+
+  run("polling", PIXY_THREAD_NONE, frames);
+  run("events", PIXY_THREAD_DEDICATED, frames);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+// Startup latency against emulated Pixies: the time to open N cameras //
+// and get an answer from each, one after the other and all at once    //
+// with PixyHandle::open_all(), which init_all() uses for real cameras. //
+// Emulated cameras skip the USB reset that fast_open skips, so this    //
+// measures the Chirp handshake, procedure lookups and thread startup.  //
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "pixyhandle.hpp"
+
+#define FRAME_RATE       50
+#define DEFAULT_CAMERAS  4
+#define RUNS             20
+
+static uint64_t now_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Opens 'pixy' and waits for its first answer, as a caller would //
+static int open_camera(PixyHandle & pixy)
+{
+  uint16_t major;
+  uint16_t minor;
+  uint16_t build;
+  int      result;
+
+  if ((result = pixy.init_emulated(FRAME_RATE, 5, 2)) != 0) {
+    return result;
+  }
+
+  return pixy.get_firmware_version(&major, &minor, &build);
+}
+
+static void report(const char * name, std::vector<uint64_t> & times)
+{
+  uint64_t total;
+  size_t   index;
+
+  std::sort(times.begin(), times.end());
+
+  for (index = 0, total = 0; index != times.size(); ++index) {
+    total += times[index];
+  }
+
+  printf("%-10s runs %3zu  mean %7.3f ms  p50 %7.3f ms  max %7.3f ms\n",
+         name, times.size(),
+         total / 1000.0 / times.size(),
+         times[times.size() / 2] / 1000.0,
+         times.back() / 1000.0);
+}
+
+static void run_sequential(int cameras)
+{
+  std::vector<uint64_t> times;
+  int                   run;
+  int                   index;
+
+  for (run = 0; run != RUNS; ++run) {
+    std::vector<PixyHandle> handles(cameras);
+    uint64_t                start = now_us();
+
+    for (index = 0; index != cameras; ++index) {
+      if (open_camera(handles[index]) != 0) {
+        fprintf(stderr, "sequential: failed to open emulated Pixy %d\n", index);
+        return;
+      }
+    }
+
+    times.push_back(now_us() - start);
+
+    for (index = 0; index != cameras; ++index) {
+      handles[index].close();
+    }
+  }
+
+  report("sequential", times);
+}
+
+static void run_parallel(int cameras)
+{
+  std::vector<uint64_t> times;
+  int                   run;
+  size_t                index;
+
+  for (run = 0; run != RUNS; ++run) {
+    std::vector<PixyHandle> handles;
+    uint64_t                start = now_us();
+
+    if (PixyHandle::open_all(handles, cameras, open_camera) != cameras) {
+      fprintf(stderr, "parallel: failed to open every emulated Pixy\n");
+      return;
+    }
+
+    times.push_back(now_us() - start);
+
+    for (index = 0; index != handles.size(); ++index) {
+      handles[index].close();
+    }
+  }
+
+  report("parallel", times);
+}
+
+int main(int argc, char * argv[])
+{
+  int cameras;
+
+  cameras = argc > 1 ? atoi(argv[1]) : DEFAULT_CAMERAS;
+
+  printf("%d emulated cameras\n", cameras);
+
+  run_sequential(cameras);
+  run_parallel(cameras);
+
+  return EXIT_SUCCESS;
+}
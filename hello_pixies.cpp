@@ -43,29 +43,19 @@ int main(int argc, char * argv[])
   // Catch CTRL+C (SIGINT) signals //
   signal(SIGINT, handle_SIGINT);
 
-  int num_pixies = PixyHandle::num_pixies_attached();
+  fprintf(stderr, "Hello Pixies:\n libpixyusb Version: %s\n", __LIBPIXY_VERSION__);
+
+  // Connect to every Pixy at once. One libpixy thread services all cameras. //
+  vector<PixyHandle>  pixy_handles;
+  int num_pixies = PixyHandle::init_all(pixy_handles, PIXY_THREAD_SHARED);
+
+  // Was there an error initializing pixies? //
   if (num_pixies <= 0) {
     fprintf(stderr, "Invalid number of pixies connected.\n");
     return EXIT_FAILURE;
   }
 
-  fprintf(stderr, "Hello Pixies:\n libpixyusb Version: %s\n", __LIBPIXY_VERSION__);
-
-  vector<int>         pixy_init_status(num_pixies);
-  vector<PixyHandle>  pixy_handles(num_pixies);
   for (int i = 0; i < num_pixies; i++) {
-    // Connect to Pixy //
-    pixy_init_status[i] = pixy_handles[i].init();
-
-    // Was there an error initializing pixy? //
-    if(pixy_init_status[i] != 0)
-    {
-      // Error initializing Pixy //
-      fprintf(stderr, "pixy_init(): ");
-      pixy_handles[i].error(pixy_init_status[i]);
-
-      return pixy_init_status[i];
-    }
 
     // Request Pixy firmware version //
     {
@@ -104,8 +94,8 @@ int main(int argc, char * argv[])
   {
     fprintf(stderr, "frame %d:\n", frame);
     for (int i = 0; i < num_pixies; i++) {
-      // Wait for new blocks to be available //
-      while(!pixy_handles[i].blocks_are_new() && run_flag); 
+      // Sleep until new blocks are available //
+      while(run_flag && pixy_handles[i].wait_for_blocks(100) == 0);
 
       // Get blocks from Pixy //
       blocks_copied[i] = pixy_handles[i].get_blocks(BLOCK_BUFFER_SIZE, &(blocks[i][0]));
@@ -123,8 +123,8 @@ int main(int argc, char * argv[])
   fprintf(stderr, "Detecting blocks...\n");
   while(run_flag)
   {
-    // Wait for new blocks to be available //
-    while(!pixy_blocks_are_new() && run_flag); 
+    // Sleep until new blocks are available //
+    while(run_flag && pixy_wait_for_blocks(100) == 0);
 
     // Get blocks from Pixy //
     blocks_copied = pixy_get_blocks(BLOCK_BUFFER_SIZE, &blocks[0]);
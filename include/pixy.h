@@ -41,13 +41,35 @@ extern "C"
   #define PIXY_RCS_MIN_POS            0
   #define PIXY_RCS_MAX_POS            1000
   #define PIXY_RCS_CENTER_POS         ((PIXY_RCS_MAX_POS-PIXY_RCS_MIN_POS)/2)
+  #define PIXY_RCS_CHANNELS           2
+  #define PIXY_RCS_DEFAULT_FREQUENCY  50
+  #define PIXY_RCS_MAX_WAYPOINTS      64
+
+  // Most blocks a frame can hold
+  #define PIXY_MAX_BLOCKS_PER_FRAME   250
+
+  // Who services a camera's connection
+  enum PixyThreading
+  {
+    PIXY_THREAD_DEDICATED,        // A libpixy thread per camera
+    PIXY_THREAD_SHARED,           // One libpixy thread for all cameras
+    PIXY_THREAD_NONE              // The application calls pixy_service()
+  };
+
+  // Order in which queued commands are sent to Pixy
+  enum PixyPriority
+  {
+    PIXY_PRIORITY_HIGH,           // Actuation: servo positions
+    PIXY_PRIORITY_NORMAL,         // Everything else
+    PIXY_PRIORITY_LOW             // LED, version queries
+  };
 
   // Block types
   #define PIXY_BLOCKTYPE_NORMAL       0
   #define PIXY_BLOCKTYPE_COLOR_CODE   1
 
   // Error codes
-  #define NUM_PIXY_ERRORS             10
+  #define NUM_PIXY_ERRORS             13
 
   const char* pixy_library_version();
 
@@ -93,6 +115,48 @@ extern "C"
     int16_t  angle;
   };
 
+  struct PixyFrame
+  {
+    uint32_t     sequence;          // Increases by one for every frame received, 0: none yet
+    uint64_t     timestamp;         // Host arrival time, microseconds on a monotonic clock
+    uint32_t     dropped;           // Frames received but never read since the previous read
+    uint16_t     number_of_blocks;  // Blocks in this frame
+    struct Block blocks[PIXY_MAX_BLOCKS_PER_FRAME];
+  };
+
+  struct PixyFrameView
+  {
+    uint32_t             sequence;          // As in PixyFrame
+    uint64_t             timestamp;         // As in PixyFrame
+    uint16_t             number_of_blocks;  // Blocks in this frame
+    const struct Block * blocks;            // Only valid during the callback
+  };
+
+  struct PixyPollfd
+  {
+    int   fd;
+    short events;  // As in struct pollfd: POLLIN, POLLOUT
+  };
+
+  // A point of a servo trajectory
+  struct PixyServoWaypoint
+  {
+    uint32_t time_ms;   // Since the trajectory was submitted
+    uint16_t position;  // Range: [0, 999]
+  };
+
+  typedef void (*pixy_frame_callback)(const struct PixyFrameView * frame, void * user_data);
+
+  /**
+    @brief Sets a directory, which must exist, to keep a catalog of Pixy's
+           procedures in per firmware version. The first connect to a
+           firmware version enumerates and saves every procedure; later
+           connects, from any process, load them instead. Call before
+           pixy_init(). Off by default.
+    @param[in] directory  NULL to turn catalogs off.
+  */
+  void pixy_set_procedure_catalog(const char * directory);
+
   /**
     @brief Creates a connection with Pixy and listens for Pixy messages.
     @return  0                         Success
@@ -104,6 +168,47 @@ extern "C"
   */
   int pixy_init();
 
+  /**
+    @brief Like pixy_init(), but without a libpixy thread. The application
+           services the connection itself by calling pixy_service(), e.g.
+           whenever a descriptor from pixy_get_pollfds() becomes ready or
+           pixy_get_next_timeout() expires.
+    @return  Same as pixy_init()
+  */
+  int pixy_init_inline();
+
+  /**
+    @brief      Inline mode: waits up to 'timeout_ms' for data from Pixy and
+                processes everything that has arrived. New frames are
+                published and frame callbacks run from the calling thread.
+    @param[in]  timeout_ms  Longest time to wait, 0 to only handle what is ready.
+    @return  Non-negative              Number of messages processed
+    @return  PIXY_ERROR_INITIALIZED    Not in inline mode
+    @return  PIXY_ERROR_INVALID_ID     ID Error: Invalid ID
+  */
+  int pixy_service(uint32_t timeout_ms);
+
+  /**
+    @brief      Inline mode: gets the file descriptors to poll for USB events.
+    @param[out] fds      Array to fill.
+    @param[in]  max_fds  Size of 'fds'.
+    @return  Non-negative              Number of descriptors in use, may exceed 'max_fds'
+    @return  PIXY_ERROR_UNSUPPORTED    Not available on this platform
+    @return  PIXY_ERROR_INVALID_ID     ID Error: Invalid ID
+  */
+  int pixy_get_pollfds(struct PixyPollfd * fds, int max_fds);
+
+  /**
+    @brief      Inline mode: gets how long the application may poll before it
+                must call pixy_service() regardless of descriptor activity.
+    @param[out] timeout_ms  Time until the next deadline (milliseconds).
+    @return  1                         'timeout_ms' was set
+    @return  0                         No deadline pending
+    @return  PIXY_ERROR_UNSUPPORTED    Not available on this platform
+    @return  PIXY_ERROR_INVALID_ID     ID Error: Invalid ID
+  */
+  int pixy_get_next_timeout(uint32_t * timeout_ms);
+
   /**
     @brief      Indicates when new block data from Pixy is received.
     @return  1  New Data:              Block data has been updated.
@@ -113,6 +218,16 @@ extern "C"
   */
   int pixy_blocks_are_new();
 
+  /**
+    @brief      Sleeps until Pixy sends new block data, or 'timeout_ms' elapses.
+                Use instead of spinning on pixy_blocks_are_new().
+    @param[in]  timeout_ms  Longest time to wait (milliseconds).
+    @return  1  New Data:              Block data has been updated.
+    @return  0  Timeout:               No new block data arrived in time.
+    @return  PIXY_ERROR_INVALID_ID     ID Error: Invalid ID
+  */
+  int pixy_wait_for_blocks(uint32_t timeout_ms);
+
   /**
     @brief      Copies up to 'max_blocks' number of Blocks to the address pointed
                 to by 'blocks'.
@@ -131,6 +246,43 @@ extern "C"
   */
   int pixy_get_blocks(uint16_t max_blocks, struct Block * blocks);
 
+  /**
+    @brief      Copies the latest frame received from Pixy to 'frame'. Unlike
+                pixy_get_blocks() only the blocks of that one frame are copied.
+    @param[out] frame  Frame sequence number, arrival time, number of frames
+                       dropped since the previous read and the frame's blocks.
+    @return  1  New Data:              'frame' was not read before.
+    @return  0  Stale Data:            'frame' was already returned by a previous
+                                       read (or sequence is 0: nothing received yet).
+    @return  PIXY_ERROR_INVALID_PARAMETER  Invalid pararmeter specified
+  */
+  int pixy_get_frame(struct PixyFrame * frame);
+
+  /**
+    @brief      Registers a function to be called for every frame received from Pixy.
+                It is called from the libpixy thread as soon as the frame is decoded,
+                with a read-only view of the frame's blocks. The callback may send
+                commands to Pixy; frames arriving while a command is in progress are
+                not reported (see the sequence numbers). It may not close the
+                connection: pixy_close() fails with PIXY_ERROR_IN_CALLBACK there.
+    @param[in]  callback   Function to call, NULL to unregister.
+    @param[in]  user_data  Passed back to 'callback'.
+    @return  0                         Success
+    @return  PIXY_ERROR_INVALID_ID     ID Error: Invalid ID
+  */
+  int pixy_on_frame(pixy_frame_callback callback, void * user_data);
+
+  /**
+    @brief      Gets a file descriptor that becomes readable whenever a new frame
+                is received from Pixy, for use with poll(), select() or epoll.
+                read() 8 bytes from it to reset it, then call pixy_get_frame().
+                The descriptor is owned by libpixy and closed by pixy_close().
+    @return  Non-negative              The file descriptor
+    @return  PIXY_ERROR_UNSUPPORTED    Not available on this platform
+    @return  PIXY_ERROR_INVALID_ID     ID Error: Invalid ID
+  */
+  int pixy_frame_fd();
+
   /**
     @brief      Send a command to Pixy.
     @param[in]  name  Chirp remote procedure call identifier string.
@@ -140,9 +292,40 @@ extern "C"
   int pixy_command(const char *name, ...);
 
   /**
-    @brief Terminates connection with Pixy.
+    @brief      Send a command to Pixy ahead of queued commands of a lower
+                priority, or not at all once 'deadline_ms' has passed.
+    @param[in]  priority     Priority class.
+    @param[in]  deadline_ms  Time to get it sent, 0 for the default of
+                             the class (see pixy_set_command_deadline()).
+    @param[in]  name         Chirp remote procedure call identifier string.
+    @return     PIXY_ERROR_TIMEOUT  Deadline passed before it was sent
+    @return     -1                  Error
+  */
+  int pixy_command_prioritized(enum PixyPriority priority, uint32_t deadline_ms, const char *name, ...);
+
+  /**
+    @brief      Sets the deadline of commands of class 'priority' that do not
+                set their own, so a late command is dropped instead of acting
+                on stale data.
+    @param[in]  priority     Priority class.
+    @param[in]  deadline_ms  Time to get a command sent, 0 for none (default).
+    @return     0         Success
+    @return     Negative  Error
+  */
+  int pixy_set_command_deadline(enum PixyPriority priority, uint32_t deadline_ms);
+
+  /**
+    @brief Terminates connection with Pixy. Transfers in progress are cancelled,
+           so it returns within a few milliseconds. Commands still queued from
+           other threads are abandoned: they are not sent and return
+           PIXY_ERROR_UNINITIALIZED. Coalesced settings posted before the
+           call are sent first.
+    @return  0                       Success
+    @return  PIXY_ERROR_IN_CALLBACK  Called from a frame callback or an async
+                                     command, on the thread servicing Pixy;
+                                     nothing was closed.
   */
-  void pixy_close();
+  int pixy_close();
 
   /**
     @brief Send description of pixy error to stdout.
@@ -282,6 +465,47 @@ extern "C"
   */
   int pixy_rcs_set_frequency(uint16_t frequency);
 
+  /**
+    @brief     Moves a servo to 'position' over 'duration_ms', in the background.
+               The libpixy thread sends positions interpolated from the current
+               one at the stream rate.
+    @param[in] channel      Channel value. Range: [0, 1]
+    @param[in] position     Target position. Range: [0, 999]
+    @param[in] duration_ms  Time to get there, 0 to jump.
+    @return      0         Success
+    @return      Negative  Error
+  */
+  int pixy_rcs_move(uint8_t channel, uint16_t position, uint32_t duration_ms);
+
+  /**
+    @brief     Streams a trajectory to a servo in the background, replacing the
+               one in progress. Positions between waypoints are interpolated
+               linearly; before the first waypoint from the current position.
+    @param[in] channel    Channel value. Range: [0, 1]
+    @param[in] waypoints  Waypoints with non-decreasing times.
+    @param[in] count      Number of waypoints. Range: [1, PIXY_RCS_MAX_WAYPOINTS]
+    @return      0         Success
+    @return      Negative  Error
+  */
+  int pixy_rcs_stream(uint8_t channel, const struct PixyServoWaypoint * waypoints, int count);
+
+  /**
+    @brief     Stops the trajectory of a servo where it is.
+    @param[in] channel  Channel value. Range: [0, 1]
+    @return      0         Success
+    @return      Negative  Error
+  */
+  int pixy_rcs_stop(uint8_t channel);
+
+  /**
+    @brief     Sets how often streamed servo positions are sent. Never more
+               often than the servo PWM frequency (pixy_rcs_set_frequency()).
+    @param     rate  Range: [1, 300] Hz Default: 50 Hz
+    @return      0         Success
+    @return      Negative  Error
+  */
+  int pixy_rcs_set_stream_rate(uint16_t rate);
+
   /**
     @brief    Get pixy firmware version.
     @param[out]  major  Major version component
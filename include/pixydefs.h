@@ -32,6 +32,9 @@
 #define PIXY_ERROR_INVALID_COMMAND          -152
 #define PIXY_ERROR_INITIALIZED              -153
 #define PIXY_ERROR_UNINITIALIZED            -154
+#define PIXY_ERROR_UNSUPPORTED              -155
+#define PIXY_ERROR_TIMEOUT                  -156
+#define PIXY_ERROR_IN_CALLBACK              -157
 
 #define CRP_ARRAY                       0x80 // bit
 #define CRP_FLT                         0x10 // bit
@@ -21,6 +21,9 @@
 #include <pixydefs.h>
 
 #include <memory>
+#include <functional>
+#include <future>
+#include <vector>
 
 #include "pixy.h"
 
@@ -28,18 +31,51 @@ class PixyInterpreter;
 
 class PixyHandle {
 public:
+  typedef std::function<void(const PixyFrameView &)> FrameCallback;
+  typedef std::function<int(PixyHandle &)>            AsyncCommand;
+  typedef std::function<void(int)>                    CommandCallback;
+  typedef std::function<int(PixyHandle &)>            Opener;
+
   PixyHandle()
   {}
 
   ~PixyHandle()
   {}
 
-  int init();
+  // 'fast_open' skips the USB reset, which is only needed if the camera //
+  // was left in a bad state; it is reset anyway if it does not answer.  //
+  int init(PixyThreading threading = PIXY_THREAD_DEDICATED, bool fast_open = false);
+  int init_emulated(uint32_t frame_rate, uint16_t normal_blocks, uint16_t color_code_blocks,
+                    PixyThreading threading = PIXY_THREAD_DEDICATED);
+  int service(uint32_t timeout_ms);
+  int get_pollfds(struct PixyPollfd *fds, int max_fds);
+  int get_next_timeout(uint32_t *timeout_ms);
   int blocks_are_new();
+  int wait_for_blocks(uint32_t timeout_ms);
   int get_blocks(uint16_t max_blocks, struct Block *blocks);
+  int get_frame(struct PixyFrame *frame);
+  int on_frame(FrameCallback callback);
+  int frame_fd();
   int command(const char *name, ...);
   int command(const char *name, va_list args);
-  void close();
+  // Ahead of queued commands of a lower priority, dropped with        //
+  // PIXY_ERROR_TIMEOUT if not sent within 'deadline_ms' (0: the       //
+  // class default). Plain command() takes the class of the procedure. //
+  int command(PixyPriority priority, uint32_t deadline_ms, const char *name, ...);
+  int command(PixyPriority priority, uint32_t deadline_ms, const char *name, va_list args);
+  int set_command_deadline(PixyPriority priority, uint32_t deadline_ms);
+
+  // Runs 'command' on the interpreter thread without waiting for it, e.g. //
+  // [](PixyHandle &pixy) { return pixy.rcs_set_position(0, 500); }       //
+  // Anything it writes through captured pointers must stay valid until   //
+  // it completes. Do not wait on the future from a frame callback.        //
+  std::future<int> command_async(AsyncCommand command);
+  int command_async(AsyncCommand command, CommandCallback callback);
+  // Returns within a few milliseconds. Commands still queued, async ones //
+  // included, are abandoned unsent with PIXY_ERROR_UNINITIALIZED, while  //
+  // coalesced settings are sent first. Fails with PIXY_ERROR_IN_CALLBACK //
+  // from a frame callback or async command.                              //
+  int close();
   void error(int error_code);
 
   int led_set_RGB(uint8_t red, uint8_t green, uint8_t blue);
@@ -58,12 +94,34 @@ public:
   int rcs_get_position(uint8_t channel);
   int rcs_set_position(uint8_t channel, uint16_t position);
   int rcs_set_frequency(uint16_t frequency);
+  int rcs_move(uint8_t channel, uint16_t position, uint32_t duration_ms);
+  int rcs_stream(uint8_t channel, const struct PixyServoWaypoint *waypoints, int count);
+  int rcs_stop(uint8_t channel);
+  int rcs_set_stream_rate(uint16_t rate);
   int get_firmware_version(uint16_t *major, uint16_t *minor, uint16_t *build);
+  int set_receive_queue(uint8_t transfers);
+  // When on, setters return at once and only the newest value of each //
+  // setting is sent, by the interpreter thread.                        //
+  int set_coalescing(bool enable);
+  // When on, getters answer from the values last read from or written //
+  // to Pixy. Enabling reads every setting once.                        //
+  int set_settings_cache(bool enable);
 
   bool available() const { return available_; }
 
   static int num_pixies_attached();
   static int num_pixies_in_use();
+  // Opens every attached Pixy that is not in use yet, all at once, into //
+  // 'handles'. Returns how many were opened, or the error if none was.  //
+  static int init_all(std::vector<PixyHandle> &handles,
+                      PixyThreading threading = PIXY_THREAD_DEDICATED, bool fast_open = false);
+  // Runs 'open' on 'count' handles at once, e.g. to open emulated       //
+  // cameras, and keeps those it returned 0 for in 'handles'. The others //
+  // are closed. Returns how many were opened, or the error if none was. //
+  static int open_all(std::vector<PixyHandle> &handles, int count, Opener open);
+  // Directory to keep procedure catalogs in, per firmware version, so //
+  // later connects skip enumerating procedures. NULL turns it off.   //
+  static void set_procedure_catalog(const char *directory);
 private:
   bool available_;
   std::shared_ptr<PixyInterpreter> interpreter_;
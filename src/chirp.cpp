@@ -15,6 +15,7 @@
 
 #include <string.h>
 #include <new>
+#include <algorithm>
 #include "chirp.hpp"
 #include "debuglog.h"
 
@@ -38,6 +39,7 @@ Chirp::Chirp(bool hinterested, bool client, Link *link)
     m_sharedMem = false;
     m_buf = NULL;
     m_bufSave = NULL;
+    m_frame = NULL;
 
     m_maxNak = CRP_MAX_NAK;
     m_retries = CRP_RETRIES;
@@ -51,6 +53,9 @@ Chirp::Chirp(bool hinterested, bool client, Link *link)
     m_hinterested = hinterested;
     m_client = client;
 
+    m_nextTag = CRP_RESPONSE_TAG_BASE;
+    m_tagResponses = false; // only the emulator is known to echo tags back, see setResponseTags()
+
     m_procTableSize = CRP_PROCTABLE_LEN;
     m_procTable = new (std::nothrow) ProcTableEntry[m_procTableSize];
     memset(m_procTable, 0, sizeof(ProcTableEntry)*m_procTableSize);
@@ -63,14 +68,16 @@ Chirp::Chirp(bool hinterested, bool client, Link *link)
 Chirp::~Chirp()
 {
   log("pixydebug: Chirp::~Chirp()\n");
-    // if we're a client, disconnect (let server know)
+    // if we're a client, disconnect (let server know). Nobody is left to
+    // take the response, so don't wait for it.
     if (m_client)
-        remoteInit(false);
+        sendCall(CRP_CALL_INIT, 0, UINT16(0), UINT8(m_hinterested), END_OUT_ARGS);
     if (!m_sharedMem)
     {
         restoreBuffer();
         delete[] m_buf;
     }
+    delete[] m_frame;
     delete[] m_procTable;
   log("pixydebug: Chirp::~Chirp() returned\n");
 }
@@ -93,7 +100,17 @@ int Chirp::setLink(Link *link)
     if (m_errorCorrected)
         m_headerLen = 12; // startcode (uint32_t), type (uint8_t), (pad), proc (uint16_t), len (uint32_t)
     else
+    {
         m_headerLen = 8;  // type (uint8_t), (pad), proc (uint16_t), len (uint32_t)
+        // startcode, header, first chunk, crc -- or a data chunk, sequence, crc
+        delete[] m_frame;
+        m_frame = new (std::nothrow) uint8_t[std::max<uint32_t>(4+m_headerLen+CRP_MAX_HEADER_LEN+2, m_blkSize+3)];
+        if (m_frame==NULL)
+        {
+            log("pixydebug: setLink() returned %d\n", CRP_RES_ERROR_MEMORY);
+            return CRP_RES_ERROR_MEMORY;
+        }
+    }
 
     if (m_sharedMem)
     {
@@ -196,6 +213,33 @@ void Chirp::restoreBuffer()
     }
 }
 
+int Chirp::swapBuffer(uint8_t **buf, uint32_t *bufSize)
+{
+    uint8_t *newbuf;
+    uint32_t newSize;
+
+    // shared memory and borrowed buffers aren't ours to give away
+    if (m_sharedMem || m_bufSave)
+        return CRP_RES_ERROR;
+
+    newbuf = *buf;
+    newSize = *bufSize;
+    if (newbuf==NULL)
+    {
+        newSize = CRP_BUFSIZE;
+        newbuf = new (std::nothrow) uint8_t[newSize];
+        if (newbuf==NULL)
+            return CRP_RES_ERROR_MEMORY;
+    }
+
+    *buf = m_buf;
+    *bufSize = m_bufSize;
+    m_buf = newbuf;
+    m_bufSize = newSize;
+
+    return CRP_RES_OK;
+}
+
 
 int Chirp::serialize(Chirp *chirp, uint8_t *buf, uint32_t bufSize, ...)
 {
@@ -539,6 +583,22 @@ int Chirp::sendChirpRetry(uint8_t type, ChirpProc proc)
     return res;
 }
 
+int Chirp::sendCall(uint8_t type, ChirpProc proc, ...)
+{
+    int res;
+    va_list args;
+
+    m_len = 0;
+    restoreBuffer();
+    va_start(args, proc);
+    res = vassemble(&args);
+    va_end(args);
+    if (res<0)
+        return res;
+
+    return sendChirpRetry(type, proc);
+}
+
 int Chirp::sendChirp(uint8_t type, ChirpProc proc)
 {
     int res;
@@ -667,14 +727,15 @@ int Chirp::reallocTable()
 
 ChirpProc Chirp::lookupTable(const char *procName)
 {
-    ChirpProc i;
+    std::map<std::string, ChirpProc>::const_iterator i;
 
-    for(i=0; i<m_procTableSize; i++)
-    {
-        if (m_procTable[i].procName!=NULL && strcmp(m_procTable[i].procName, procName)==0)
-            return i;
-    }
-    return -1;
+    if (procName==NULL)
+        return -1;
+
+    i = m_procIndex.find(procName);
+    if (i==m_procIndex.end())
+        return -1;
+    return i->second;
 }
 
 
@@ -699,6 +760,7 @@ ChirpProc Chirp::updateTable(const char *procName, ProcPtr procPtr)
     // add to table
     m_procTable[proc].procName = procName;
     m_procTable[proc].procPtr = procPtr;
+    m_procIndex[procName] = proc;
 
     return proc;
 }
@@ -710,6 +772,8 @@ ChirpProc Chirp::getProc(const char *procName, ProcPtr callback)
 
     if (callback)
         cproc = updateTable(procName, callback);
+    else if (m_client && m_tagResponses) // have the responses tagged anyway, so pipelined calls can be told apart
+        cproc = m_nextTag++;
 
     if (call(CRP_CALL_ENUMERATE, 0,
              STRING(procName), // send name
@@ -718,7 +782,11 @@ ChirpProc Chirp::getProc(const char *procName, ProcPtr callback)
              &res, // get remote index
              END_IN_ARGS
              )>=0)
+    {
+        if ((ChirpProc)res>=0 && cproc>=0)
+            m_responseTags[res] = cproc;
         return res;
+    }
 
     // a negative ChirpProc is an error
     return -1;
@@ -797,13 +865,21 @@ void Chirp::setRecvTimeout(uint32_t timeout)
     m_headerTimeout = timeout;
 }
 
+void Chirp::setResponseTags(bool enable)
+{
+    m_tagResponses = enable;
+    if (!enable)
+        m_responseTags.clear();
+}
+
 int32_t Chirp::handleEnumerate(char *procName, ChirpProc *callback)
 {
     ChirpProc proc;
     // lookup in table
     proc = lookupTable(procName);
     // set remote index in table
-    m_procTable[proc].chirpProc = *callback;
+    if (proc>=0)
+        m_procTable[proc].chirpProc = *callback;
 
     return proc;
 }
@@ -828,10 +904,14 @@ int32_t Chirp::handleEnumerateInfo(ChirpProc *proc)
     const ProcTableExtension *extension;
     uint8_t null = '\0';
 
-    if (*proc>=m_procTableSize || m_procTable[*proc].procName==NULL)
-        extension = NULL;
-    else
-        extension = m_procTable[*proc].extension;
+    if (*proc<0 || *proc>=m_procTableSize || m_procTable[*proc].procName==NULL)
+    {
+        // past the end of the table, empty name
+        CRP_RETURN(this, STRING(&null), STRING(&null), STRING(&null), END);
+        return CRP_RES_ERROR;
+    }
+
+    extension = m_procTable[*proc].extension;
 
     if (extension)
     {
@@ -888,6 +968,86 @@ int Chirp::service(bool all)
     return i;
 }
 
+int Chirp::callPipelined(ChirpCall calls[], uint32_t count)
+{
+    int res = CRP_RES_ERROR_NOT_CONNECTED;
+    uint32_t i, pending;
+    uint8_t type;
+    ChirpProc recvProc;
+    void *recvArgs[CRP_MAX_ARGS+1];
+
+    if (!m_connected)
+    {
+        for (i=0; i<count; i++)
+            calls[i].result = res;
+        return res;
+    }
+
+    // send every call before waiting for any response
+    for (i=0, pending=0; i<count; i++)
+    {
+        calls[i].tag = responseTag(calls[i].proc);
+        m_len = 0;
+        restoreBuffer();
+        if ((res=vassemble(calls[i].args))<0)
+            calls[i].result = res;
+        else if ((res=sendChirpRetry(CRP_CALL, calls[i].proc))!=CRP_RES_OK)
+            break;
+        else
+        {
+            calls[i].result = CRP_RES_PENDING;
+            pending++;
+        }
+    }
+    for (; i<count; i++) // the link failed, the rest wasn't sent
+        calls[i].result = res;
+
+    // collect the responses while servicing other calls
+    m_link->setTimer();
+    while (pending)
+    {
+        if ((res=recvChirp(&type, &recvProc, recvArgs, true))!=CRP_RES_OK)
+            break;
+        if (type&CRP_RESPONSE)
+        {
+            for (i=0; i<count && !(calls[i].result==CRP_RES_PENDING && calls[i].tag==recvProc); i++);
+            if (i==count) // untagged, the server answers in call order
+                for (i=0; calls[i].result!=CRP_RES_PENDING; i++);
+
+            calls[i].result = loadArgs(calls[i].args, recvArgs);
+            // returned arrays point into m_buf, keep them away from the next response
+            swapBuffer(&calls[i].buf, &calls[i].bufSize);
+            pending--;
+            m_link->setTimer();
+        }
+        else
+            handleChirp(type, recvProc, (const void **)recvArgs);
+        if (pending && m_link->getTimer()>m_headerTimeout)
+        {
+            res = CRP_RES_ERROR_RECV_TIMEOUT;
+            break;
+        }
+    }
+
+    for (i=0; i<count; i++)
+    {
+        if (calls[i].result==CRP_RES_PENDING)
+            calls[i].result = res;
+    }
+
+    return pending ? res : CRP_RES_OK;
+}
+
+ChirpProc Chirp::responseTag(ChirpProc proc)
+{
+    std::map<ChirpProc, ChirpProc>::const_iterator i;
+
+    i = m_responseTags.find(proc);
+    if (i==m_responseTags.end())
+        return -1;
+    return i->second;
+}
+
 int Chirp::recvChirp(uint8_t *type, ChirpProc *proc, void *args[], bool wait) // null pointer terminates
 {
     int res;
@@ -1065,20 +1225,20 @@ uint16_t Chirp::calcCrc(uint8_t *buf, uint32_t len)
 int Chirp::sendFull(uint8_t type, ChirpProc proc)
 {
     int res;
+    uint32_t len;
 
     *(uint32_t *)m_buf = CRP_START_CODE;
     *(uint8_t *)(m_buf+4) = type;
     *(ChirpProc *)(m_buf+6) = proc;
     *(uint32_t *)(m_buf+8) = m_len;
-    // send header
-    if ((res=m_link->send(m_buf, CRP_MAX_HEADER_LEN, m_sendTimeout))<0)
+    // header and data go out in one send, at least CRP_MAX_HEADER_LEN long
+    // since the receiver reads that much first (with shared memory, only
+    // the header is sent)
+    len = m_headerLen+m_len;
+    if (len<CRP_MAX_HEADER_LEN || m_sharedMem)
+        len = CRP_MAX_HEADER_LEN;
+    if ((res=m_link->send(m_buf, len, m_sendTimeout))<0)
         return res;
-    // if we haven't sent everything yet....
-    if (m_len+m_headerLen>CRP_MAX_HEADER_LEN && !m_sharedMem)
-    {
-        if ((res=m_link->send(m_buf+CRP_MAX_HEADER_LEN, m_len-(CRP_MAX_HEADER_LEN-m_headerLen), m_sendTimeout))<0)
-            return res;
-    }
     return CRP_RES_OK;
 }
 
@@ -1086,30 +1246,34 @@ int Chirp::sendHeader(uint8_t type, ChirpProc proc)
 {
     int res;
     bool ack;
-    uint32_t chunk, startCode = CRP_START_CODE;
+    uint32_t len, chunk, startCode = CRP_START_CODE;
     uint16_t crc;
 
-    if ((res=m_link->send((uint8_t *)&startCode, 4, m_sendTimeout))<0)
-        return res;
-
     *(uint8_t *)m_buf = type;
     *(uint16_t *)(m_buf+2) = proc;
     *(uint32_t *)(m_buf+4) = m_len;
-    if ((res=m_link->send(m_buf, m_headerLen, m_sendTimeout))<0)
-        return res;
     crc = calcCrc(m_buf, m_headerLen);
 
     if (m_len>=CRP_MAX_HEADER_LEN)
         chunk = CRP_MAX_HEADER_LEN;
     else
         chunk = m_len;
-    if (m_link->send(m_buf, chunk, m_sendTimeout)<0)
-        return CRP_RES_ERROR_SEND_TIMEOUT;
-
-    // send crc
     crc += calcCrc(m_buf, chunk);
-    if (m_link->send((uint8_t *)&crc, 2, m_sendTimeout)<0)
-        return CRP_RES_ERROR_SEND_TIMEOUT;
+
+    if (m_frame==NULL) // setLink() couldn't allocate it
+        return CRP_RES_ERROR_MEMORY;
+
+    // stage startcode, header, chunk and crc, and send them in one go
+    memcpy(m_frame, &startCode, 4);
+    len = 4;
+    memcpy(m_frame+len, m_buf, m_headerLen);
+    len += m_headerLen;
+    memcpy(m_frame+len, m_buf, chunk);
+    len += chunk;
+    memcpy(m_frame+len, &crc, 2);
+    len += 2;
+    if ((res=m_link->send(m_frame, len, m_sendTimeout))<0)
+        return res;
 
     if ((res=recvAck(&ack, m_headerTimeout))<0)
         return res;
@@ -1136,15 +1300,12 @@ int Chirp::sendData()
             chunk = m_blkSize;
         else
             chunk = m_len-m_offset;
-        // send data
-        if (m_link->send(m_buf+m_offset, chunk, m_sendTimeout)<0)
-            return CRP_RES_ERROR_SEND_TIMEOUT;
-        // send sequence
-        if (m_link->send((uint8_t *)&sequence, 1, m_sendTimeout)<0)
-            return CRP_RES_ERROR_SEND_TIMEOUT;
-        // send crc
+        // send data, sequence and crc in one go
         crc = calcCrc(m_buf+m_offset, chunk) + calcCrc((uint8_t *)&sequence, 1);
-        if (m_link->send((uint8_t *)&crc, 2, m_sendTimeout)<0)
+        memcpy(m_frame, m_buf+m_offset, chunk);
+        m_frame[chunk] = sequence;
+        memcpy(m_frame+chunk+1, &crc, 2);
+        if (m_link->send(m_frame, chunk+3, m_sendTimeout)<0)
             return CRP_RES_ERROR_SEND_TIMEOUT;
 
         if ((res=recvAck(&ack, m_dataTimeout))<0)
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <map>
+#include <string>
 #include "link.h"
 
 #define ALIGN(v, n)  v = v&((n)-1) ? (v&~((n)-1))+(n) : v
@@ -18,6 +20,7 @@
 #define CRP_RES_ERROR_MAX_NAK           -4
 #define CRP_RES_ERROR_MEMORY            -5
 #define CRP_RES_ERROR_NOT_CONNECTED     -6
+#define CRP_RES_PENDING                 1 // pipelined call still waiting for its response
 
 #define CRP_MAX_NAK                     3
 #define CRP_RETRIES                     3
@@ -29,6 +32,7 @@
 #define CRP_BUFSIZE                     0x80
 #define CRP_BUFPAD                      8
 #define CRP_PROCTABLE_LEN               0x40
+#define CRP_RESPONSE_TAG_BASE           0x4000 // tags for responses to procs without a local callback
 
 #define CRP_START_CODE                  0xaaaa5555
 
@@ -200,11 +204,21 @@ struct ProcTableEntry
     const ProcTableExtension *extension;
 };
 
+struct ChirpCall
+{
+    ChirpProc proc;
+    va_list *args; // as for call(), used up by the call
+    uint8_t *buf; // traded for the receive buffer holding the response, see swapBuffer()
+    uint32_t bufSize;
+    int result;
+    ChirpProc tag; // set by callPipelined()
+};
+
 class Chirp
 {
 public:
     Chirp(bool hinterested=false, bool client=false, Link *link=NULL);
-    ~Chirp();
+    virtual ~Chirp();
 
     virtual int init(bool connect);
     int setLink(Link *link);
@@ -214,9 +228,16 @@ public:
     int registerModule(const ProcModule *module);
     void setSendTimeout(uint32_t timeout);
     void setRecvTimeout(uint32_t timeout);
+    // tag responses by the procedure they answer, only reliable if every procedure called
+    // was enumerated on this connection and the server echoes the tag it was sent (off by
+    // default: untagged responses are matched to pipelined calls in call order)
+    void setResponseTags(bool enable);
 
     int call(uint8_t service, ChirpProc proc, ...);
     int call(uint8_t service, ChirpProc proc, va_list args);
+    // send all 'calls' back to back, then collect the responses, matching them to
+    // the calls by response tag if tagged, otherwise in call order
+    int callPipelined(ChirpCall calls[], uint32_t count);
     static uint8_t getType(const void *arg);
     int service(bool all=true);
     int assemble(uint8_t type, ...);
@@ -231,6 +252,9 @@ public:
     static int loadArgs(va_list *args, void *recvArgs[]);
     static int getArgList(uint8_t *buf, uint32_t len, uint8_t *argList);
     int useBuffer(uint8_t *buf, uint32_t len);
+    // trade the receive buffer for 'buf' (NULL for a new one), so returned pointers
+    // stay valid while this chirp goes on with other calls
+    int swapBuffer(uint8_t **buf, uint32_t *bufSize);
 
     static uint16_t calcCrc(uint8_t *buf, uint32_t len);
 
@@ -263,6 +287,7 @@ private:
     int sendData();
     int sendAck(bool ack); // false=nack
     int sendChirpRetry(uint8_t type, ChirpProc proc);
+    int sendCall(uint8_t type, ChirpProc proc, ...); // like call(), but doesn't wait for the response
     int recvHeader(uint8_t *type, ChirpProc *proc, bool wait);
     int recvFull(uint8_t *type, ChirpProc *proc, bool wait);
     int recvData();
@@ -275,11 +300,17 @@ private:
 
     ChirpProc updateTable(const char *procName, ProcPtr procPtr);
     ChirpProc lookupTable(const char *procName);
+    ChirpProc responseTag(ChirpProc proc);
     int realloc(uint32_t min=0);
     int reallocTable();
 
     Link *m_link;
+    uint8_t *m_frame; // non error corrected links: staging so each packet goes out in one send
     ProcTableEntry *m_procTable;
+    std::map<std::string, ChirpProc> m_procIndex; // procName -> index into m_procTable
+    std::map<ChirpProc, ChirpProc> m_responseTags; // remote proc -> proc in its responses
+    ChirpProc m_nextTag;
+    bool m_tagResponses;
     uint16_t m_procTableSize;
     uint16_t m_blkSize;
     uint8_t m_maxNak;
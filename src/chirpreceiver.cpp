@@ -15,7 +15,7 @@
 
 #include "chirpreceiver.hpp"
 
-ChirpReceiver::ChirpReceiver(USBLink * link, Interpreter * interpreter)
+ChirpReceiver::ChirpReceiver(Link * link, Interpreter * interpreter)
 {
   m_hinterested = true;
   m_client      = true;
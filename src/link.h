@@ -41,7 +41,7 @@ public:
         m_flags = 0;
         m_blockSize = 0;
     }
-    ~Link()
+    virtual ~Link()
     {
     }
 
@@ -68,6 +68,29 @@ public:
         return LINK_RESULT_ERROR;
     }
 
+    // Host side: block until received data is ready, or timeoutMs elapses.
+    // Returns > 0 when data is ready (or the link can't tell), 0 on timeout
+    // and a negative result code on error.
+    virtual int waitForData(uint16_t timeoutMs)
+    {
+        return 1;
+    }
+    // Host side: number of received bytes ready to be read without blocking.
+    virtual uint32_t pending()
+    {
+        return 0;
+    }
+    // Host side: makes a waitForData() in progress, or else the next one,
+    // return early. It returns 0 unless data is ready after all.
+    virtual void wake()
+    {
+    }
+    // Host side: from any thread, for shutting down. Receives in progress,
+    // and all later ones, return at once with whatever already arrived.
+    virtual void cancel()
+    {
+    }
+
 protected:
     uint32_t m_flags;
     uint32_t m_blockSize;
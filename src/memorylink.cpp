@@ -0,0 +1,152 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#include <algorithm>
+#include <chrono>
+
+#include "memorylink.h"
+
+MemoryLink::MemoryLink()
+{
+  // Same framing as the USB link: 64 byte packets, error corrected //
+  m_blockSize = 64;
+  m_flags = LINK_FLAG_ERROR_CORRECTED;
+  woken_ = false;
+  cancelled_ = false;
+}
+
+MemoryLink::~MemoryLink()
+{
+  close();
+}
+
+void MemoryLink::connect(MemoryLink &a, MemoryLink &b)
+{
+  a.tx_ = b.rx_ = std::make_shared<Channel>();
+  b.tx_ = a.rx_ = std::make_shared<Channel>();
+}
+
+void MemoryLink::close()
+{
+  std::shared_ptr<Channel> channels[2] = { rx_, tx_ };
+
+  for (int i = 0; i < 2; i++)
+  {
+    if (!channels[i])
+      continue;
+    std::lock_guard<std::mutex> lock(channels[i]->mutex);
+    channels[i]->closed = true;
+    channels[i]->ready.notify_all();
+  }
+}
+
+int MemoryLink::send(const uint8_t *data, uint32_t len, uint16_t timeoutMs)
+{
+  if (!tx_)
+    return LINK_RESULT_ERROR;
+
+  std::lock_guard<std::mutex> lock(tx_->mutex);
+  if (tx_->closed)
+    return LINK_RESULT_ERROR;
+
+  tx_->data.insert(tx_->data.end(), data, data + len);
+  tx_->ready.notify_all();
+
+  return len;
+}
+
+int MemoryLink::receive(uint8_t *data, uint32_t len, uint16_t timeoutMs)
+{
+  uint32_t wanted, copied;
+
+  if (!rx_)
+    return LINK_RESULT_ERROR;
+
+  if (timeoutMs==0) // 0 equals infinity
+    timeoutMs = 50;
+
+  // Like a bulk transfer, return once at least a packet (or everything //
+  // that was asked for, if less) is available.                          //
+  wanted = len < m_blockSize ? len : m_blockSize;
+
+  std::unique_lock<std::mutex> lock(rx_->mutex);
+  if (!rx_->ready.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                           [&]{ return rx_->closed || cancelled_ || rx_->data.size() >= wanted; }) &&
+      rx_->data.empty())
+    return LINK_RESULT_ERROR_RECV_TIMEOUT;
+
+  if (rx_->data.empty())
+    return cancelled_ ? LINK_RESULT_ERROR_RECV_TIMEOUT : LINK_RESULT_ERROR;
+
+  copied = std::min<uint32_t>(len, rx_->data.size());
+  std::copy(rx_->data.begin(), rx_->data.begin() + copied, data);
+  rx_->data.erase(rx_->data.begin(), rx_->data.begin() + copied);
+
+  return copied;
+}
+
+int MemoryLink::waitForData(uint16_t timeoutMs)
+{
+  if (!rx_)
+    return LINK_RESULT_ERROR;
+
+  std::unique_lock<std::mutex> lock(rx_->mutex);
+  rx_->ready.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                      [&]{ return rx_->closed || woken_ || cancelled_ || !rx_->data.empty(); });
+  woken_ = false;
+
+  if (!rx_->data.empty())
+    return rx_->data.size();
+  return rx_->closed ? LINK_RESULT_ERROR : 0;
+}
+
+uint32_t MemoryLink::pending()
+{
+  if (!rx_)
+    return 0;
+
+  std::lock_guard<std::mutex> lock(rx_->mutex);
+  return rx_->data.size();
+}
+
+void MemoryLink::wake()
+{
+  if (!rx_)
+    return;
+
+  std::lock_guard<std::mutex> lock(rx_->mutex);
+  woken_ = true;
+  rx_->ready.notify_all();
+}
+
+void MemoryLink::cancel()
+{
+  if (!rx_)
+    return;
+
+  std::lock_guard<std::mutex> lock(rx_->mutex);
+  cancelled_ = true;
+  rx_->ready.notify_all();
+}
+
+void MemoryLink::setTimer()
+{
+  timer_.reset();
+}
+
+uint32_t MemoryLink::getTimer()
+{
+  return timer_.elapsed();
+}
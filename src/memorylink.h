@@ -0,0 +1,74 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#ifndef _MEMORYLINK_H
+#define _MEMORYLINK_H
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+
+#include <link.h>
+
+#include "utils/timer.hpp"
+
+// An in-process Link. Two MemoryLinks joined with connect() behave like  //
+// the two ends of the Pixy USB connection, so a Chirp client and server  //
+// can talk to each other without hardware.                               //
+class MemoryLink : public Link
+{
+public:
+  MemoryLink();
+  virtual ~MemoryLink();
+
+  /**
+    @brief  Joins two links: what one end sends, the other end receives.
+  */
+  static void connect(MemoryLink &a, MemoryLink &b);
+
+  /**
+    @brief  Shuts both directions down. Blocked receivers return an error.
+  */
+  void close();
+
+  virtual int send(const uint8_t *data, uint32_t len, uint16_t timeoutMs);
+  virtual int receive(uint8_t *data, uint32_t len, uint16_t timeoutMs);
+  virtual void setTimer();
+  virtual uint32_t getTimer();
+  virtual int waitForData(uint16_t timeoutMs);
+  virtual uint32_t pending();
+  virtual void wake();
+  virtual void cancel();
+
+private:
+  struct Channel
+  {
+    Channel() : closed(false) {}
+
+    std::mutex              mutex;
+    std::condition_variable ready;
+    std::deque<uint8_t>     data;
+    bool                    closed;
+  };
+
+  std::shared_ptr<Channel> rx_;
+  std::shared_ptr<Channel> tx_;
+  util::timer timer_;
+  bool woken_;     // guarded by the mutex of 'rx_'
+  bool cancelled_; // guarded by the mutex of 'rx_'
+};
+
+#endif
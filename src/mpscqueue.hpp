@@ -0,0 +1,104 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+#ifndef __MPSCQUEUE_HPP__
+#define __MPSCQUEUE_HPP__
+
+#include <atomic>
+
+/**
+  @brief  Queue that any number of threads push to and a single
+          thread pops from, without locks.
+
+          Intrusive: 'T' carries the link itself as a member
+          'std::atomic<T *> next', so pushing never allocates and an
+          item may live on the pusher's stack for as long as it is
+          queued. Pushing is one atomic exchange. A pop that races a
+          push still in progress may miss that item; the pusher is
+          expected to signal the consumer once push() returns.
+*/
+template <typename T>
+class MpscQueue
+{
+  public:
+
+    MpscQueue() : head_(&stub_)
+    {
+      stub_.next = 0;
+      tail_      = &stub_;
+    }
+
+    /**
+      @brief  Any thread: appends 'item'.
+    */
+    void push(T * item)
+    {
+      T * previous;
+
+      item->next.store(0, std::memory_order_relaxed);
+      previous = head_.exchange(item, std::memory_order_acq_rel);
+
+      // Until this store the consumer cannot see past 'previous' //
+      previous->next.store(item, std::memory_order_release);
+    }
+
+    /**
+      @brief  Consumer thread only: removes the oldest item.
+      @return The item, or 0 if none is (completely) pushed yet.
+    */
+    T * pop()
+    {
+      T * tail = tail_;
+      T * next = tail->next.load(std::memory_order_acquire);
+
+      // Step over the placeholder that keeps the list non-empty //
+      if (tail == &stub_) {
+        if (next == 0) {
+          return 0;
+        }
+        tail_ = next;
+        tail  = next;
+        next  = next->next.load(std::memory_order_acquire);
+      }
+
+      if (next) {
+        tail_ = next;
+        return tail;
+      }
+
+      // 'tail' is the last item unless a push is halfway done //
+      if (tail != head_.load(std::memory_order_acquire)) {
+        return 0;
+      }
+
+      // Put the placeholder behind it so 'tail' can be handed out //
+      push(&stub_);
+
+      next = tail->next.load(std::memory_order_acquire);
+      if (next) {
+        tail_ = next;
+        return tail;
+      }
+
+      return 0;
+    }
+
+  private:
+
+    std::atomic<T *> head_;   // Newest item, pushers swap themselves in here
+    T *              tail_;   // Oldest item, owned by the consumer
+    T                stub_;
+};
+
+#endif
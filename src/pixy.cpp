@@ -82,6 +82,9 @@ extern "C"
     { PIXY_ERROR_INVALID_COMMAND, "Pixy Error: Invalid command" },
     { PIXY_ERROR_INITIALIZED,     "Pixy Error: Initialized" },
     { PIXY_ERROR_UNINITIALIZED,   "Pixy Error: Uninitialized" },
+    { PIXY_ERROR_UNSUPPORTED,     "Pixy Error: Not supported on this platform" },
+    { PIXY_ERROR_TIMEOUT,         "Pixy Error: Command deadline passed" },
+    { PIXY_ERROR_IN_CALLBACK,     "Pixy Error: Not allowed from a callback" },
     { 0,                          0 }
   };
 
@@ -89,21 +92,72 @@ extern "C"
     return __LIBPIXY_VERSION__;
   }
 
+  void pixy_set_procedure_catalog(const char * directory)
+  {
+    PixyHandle::set_procedure_catalog(directory);
+  }
+
   int pixy_init()
   {
     return handle.init();
   }
 
+  int pixy_init_inline()
+  {
+    return handle.init(PIXY_THREAD_NONE);
+  }
+
+  int pixy_service(uint32_t timeout_ms)
+  {
+    return handle.service(timeout_ms);
+  }
+
+  int pixy_get_pollfds(struct PixyPollfd * fds, int max_fds)
+  {
+    return handle.get_pollfds(fds, max_fds);
+  }
+
+  int pixy_get_next_timeout(uint32_t * timeout_ms)
+  {
+    return handle.get_next_timeout(timeout_ms);
+  }
+
   int pixy_get_blocks(uint16_t max_blocks, struct Block * blocks)
   {
     return handle.get_blocks(max_blocks, blocks);
   }
 
+  int pixy_get_frame(struct PixyFrame * frame)
+  {
+    return handle.get_frame(frame);
+  }
+
+  int pixy_on_frame(pixy_frame_callback callback, void * user_data)
+  {
+    if (callback == NULL) {
+      return handle.on_frame(PixyHandle::FrameCallback());
+    }
+
+    return handle.on_frame([callback, user_data](const PixyFrameView & frame) {
+      callback(&frame, user_data);
+    });
+  }
+
+  int pixy_frame_fd()
+  {
+    return handle.frame_fd();
+  }
+
   int pixy_blocks_are_new()
   {
     return handle.blocks_are_new();
   }
 
+  int pixy_wait_for_blocks(uint32_t timeout_ms)
+  {
+    return handle.wait_for_blocks(timeout_ms);
+  }
+
   int pixy_command(const char *name, ...)
   {
     va_list arguments;
@@ -116,9 +170,26 @@ extern "C"
     return return_value;
   }
 
-  void pixy_close()
+  int pixy_command_prioritized(enum PixyPriority priority, uint32_t deadline_ms, const char *name, ...)
+  {
+    va_list arguments;
+    int return_value;
+
+    va_start(arguments, name);
+    return_value = handle.command(priority, deadline_ms, name, arguments);
+    va_end(arguments);
+
+    return return_value;
+  }
+
+  int pixy_set_command_deadline(enum PixyPriority priority, uint32_t deadline_ms)
+  {
+    return handle.set_command_deadline(priority, deadline_ms);
+  }
+
+  int pixy_close()
   {
-    handle.close();
+    return handle.close();
   }
 
   void pixy_error(int error_code)
@@ -206,6 +277,26 @@ extern "C"
     return handle.rcs_set_frequency(frequency);
   }
 
+  int pixy_rcs_move(uint8_t channel, uint16_t position, uint32_t duration_ms)
+  {
+    return handle.rcs_move(channel, position, duration_ms);
+  }
+
+  int pixy_rcs_stream(uint8_t channel, const struct PixyServoWaypoint * waypoints, int count)
+  {
+    return handle.rcs_stream(channel, waypoints, count);
+  }
+
+  int pixy_rcs_stop(uint8_t channel)
+  {
+    return handle.rcs_stop(channel);
+  }
+
+  int pixy_rcs_set_stream_rate(uint16_t rate)
+  {
+    return handle.rcs_set_stream_rate(rate);
+  }
+
   int pixy_get_firmware_version(uint16_t * major, uint16_t * minor, uint16_t * build)
   {
     return handle.get_firmware_version(major, minor, build);
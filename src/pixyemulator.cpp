@@ -0,0 +1,323 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#include <chrono>
+#include "pixyemulator.hpp"
+
+using std::chrono::steady_clock;
+
+struct EmulatedProc
+{
+  const char * name;
+  ProcPtr      procedure;
+};
+
+PixyEmulator::PixyEmulator(uint32_t frame_rate, uint16_t normal_blocks, uint16_t color_code_blocks)
+  : Chirp(false, false)
+{
+  const EmulatedProc procedures[] = {
+    { "cam_setAWB",        (ProcPtr) cam_setAWB },
+    { "cam_getAWB",        (ProcPtr) cam_getAWB },
+    { "cam_setWBV",        (ProcPtr) cam_setWBV },
+    { "cam_getWBV",        (ProcPtr) cam_getWBV },
+    { "cam_setAEC",        (ProcPtr) cam_setAEC },
+    { "cam_getAEC",        (ProcPtr) cam_getAEC },
+    { "cam_setECV",        (ProcPtr) cam_setECV },
+    { "cam_getECV",        (ProcPtr) cam_getECV },
+    { "cam_setBrightness", (ProcPtr) cam_setBrightness },
+    { "cam_getBrightness", (ProcPtr) cam_getBrightness },
+    { "led_set",           (ProcPtr) led_set },
+    { "led_setMaxCurrent", (ProcPtr) led_setMaxCurrent },
+    { "led_getMaxCurrent", (ProcPtr) led_getMaxCurrent },
+    { "rcs_setPos",        (ProcPtr) rcs_setPos },
+    { "rcs_getPos",        (ProcPtr) rcs_getPos },
+    { "rcs_setFreq",       (ProcPtr) rcs_setFreq },
+    { "version",           (ProcPtr) version },
+    { "emu_getCalls",      (ProcPtr) emu_getCalls },
+    { NULL,                NULL }
+  };
+  int index;
+
+  thread_die_      = false;
+  frames_sent_     = 0;
+  last_frame_time_ = 0;
+  calls_           = 0;
+
+  frame_rate_        = frame_rate;
+  normal_blocks_     = normal_blocks < PIXY_EMULATOR_MAX_BLOCKS ? normal_blocks : PIXY_EMULATOR_MAX_BLOCKS;
+  color_code_blocks_ = color_code_blocks < PIXY_EMULATOR_MAX_BLOCKS ? color_code_blocks : PIXY_EMULATOR_MAX_BLOCKS;
+
+  // Power-on defaults of the firmware //
+  auto_white_balance_         = 1;
+  white_balance_value_        = 0;
+  auto_exposure_compensation_ = 1;
+  exposure_compensation_      = 0;
+  brightness_                 = 80;
+  led_max_current_            = 40000;
+  led_rgb_                    = 0;
+  rcs_frequency_              = 50;
+
+  for (index = 0; index != PIXY_RCS_CHANNELS; ++index) {
+    rcs_position_[index] = PIXY_RCS_CENTER_POS;
+  }
+
+  for (index = 0; procedures[index].name; ++index) {
+    setProc(procedures[index].name, procedures[index].procedure);
+  }
+
+  MemoryLink::connect(link_, host_link_);
+  setLink(&link_);
+}
+
+PixyEmulator::~PixyEmulator()
+{
+  stop();
+}
+
+void PixyEmulator::start()
+{
+  if (thread_.joinable()) {
+    return;
+  }
+
+  thread_die_ = false;
+  thread_     = std::thread(&PixyEmulator::emulator_thread, this);
+}
+
+void PixyEmulator::stop()
+{
+  if (thread_.joinable()) {
+    thread_die_ = true;
+    link_.wake();
+    thread_.join();
+  }
+
+  // Anyone still talking to us sees the link go down //
+  link_.close();
+}
+
+void PixyEmulator::emulator_thread()
+{
+  steady_clock::time_point next_frame;
+  steady_clock::time_point now;
+  steady_clock::duration   frame_period;
+  int64_t                  wait;
+
+  frame_period = frame_rate_ ? steady_clock::duration(std::chrono::seconds(1)) / frame_rate_ : steady_clock::duration(0);
+  next_frame   = steady_clock::now();
+
+  while (!thread_die_) {
+    wait = PIXY_EMULATOR_WAIT_TIMEOUT;
+
+    // Frames only flow once the host has connected //
+    if (frame_rate_ && connected()) {
+      now = steady_clock::now();
+
+      if (now >= next_frame) {
+        send_frame();
+        next_frame += frame_period;
+
+        // Fell behind (slow host), don't burst to catch up //
+        if (next_frame < now) {
+          next_frame = now;
+        }
+        wait = 0;
+      } else {
+        wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_frame - now).count();
+        if (wait > PIXY_EMULATOR_WAIT_TIMEOUT) {
+          wait = PIXY_EMULATOR_WAIT_TIMEOUT;
+        }
+      }
+    }
+
+    if (link_.waitForData(wait) > 0) {
+      do {
+        service(false);
+      } while (link_.pending() > 0);
+    }
+  }
+}
+
+void PixyEmulator::send_frame()
+{
+  uint32_t frame;
+  uint32_t normal_length;
+  uint32_t color_code_length;
+  uint16_t index;
+  uint16_t x;
+  uint16_t y;
+
+  frame = frames_sent_;
+
+  // Blocks drift across the image so consecutive frames differ //
+
+  for (index = 0; index != normal_blocks_; ++index) {
+    x = (frame * 2 + index * 37) % (PIXY_EMULATOR_WIDTH - 20);
+    y = (frame + index * 23) % (PIXY_EMULATOR_HEIGHT - 20);
+    normal_blobs_[index] = BlobA(index % PIXY_MAX_SIGNATURE + 1, x, x + 20, y, y + 20);
+  }
+
+  for (index = 0; index != color_code_blocks_; ++index) {
+    x = (frame * 3 + index * 41) % (PIXY_EMULATOR_WIDTH - 30);
+    y = (frame * 2 + index * 29) % (PIXY_EMULATOR_HEIGHT - 30);
+
+    // Two-signature color code, e.g. 012 //
+    color_code_blobs_[index] = BlobB(((index % 6 + 1) << 3) | (index % 6 + 2), x, x + 30, y, y + 30,
+                                     (int16_t) ((frame + index * 15) % 360) - 180);
+  }
+
+  // Array lengths are in uint16_t units //
+  normal_length     = normal_blocks_ * sizeof(BlobA) / sizeof(uint16_t);
+  color_code_length = color_code_blocks_ * sizeof(BlobB) / sizeof(uint16_t);
+
+  last_frame_time_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                       steady_clock::now().time_since_epoch()).count();
+
+  if (color_code_blocks_) {
+    CRP_SEND_XDATA(this, HTYPE(FOURCC('C', 'C', 'B', '2')), HINT8(0),
+                   HINT16(PIXY_EMULATOR_WIDTH), HINT16(PIXY_EMULATOR_HEIGHT),
+                   UINTS16(normal_length, normal_blobs_),
+                   UINTS16(color_code_length, color_code_blobs_));
+  } else {
+    CRP_SEND_XDATA(this, HTYPE(FOURCC('C', 'C', 'B', '1')), HINT8(0),
+                   HINT16(PIXY_EMULATOR_WIDTH), HINT16(PIXY_EMULATOR_HEIGHT),
+                   UINTS16(normal_length, normal_blobs_));
+  }
+
+  frames_sent_++;
+}
+
+int PixyEmulator::handleChirp(uint8_t type, ChirpProc proc, const void * args[])
+{
+  if ((type & CRP_CALL) && !(type & CRP_INTRINSIC)) {
+    calls_++;
+  }
+
+  return Chirp::handleChirp(type, proc, args);
+}
+
+uint32_t PixyEmulator::cam_setAWB(const uint8_t * enable, Chirp * chirp)
+{
+  static_cast<PixyEmulator *>(chirp)->auto_white_balance_ = *enable;
+  return 0;
+}
+
+uint32_t PixyEmulator::cam_getAWB(Chirp * chirp)
+{
+  return static_cast<PixyEmulator *>(chirp)->auto_white_balance_;
+}
+
+uint32_t PixyEmulator::cam_setWBV(const uint32_t * value, Chirp * chirp)
+{
+  static_cast<PixyEmulator *>(chirp)->white_balance_value_ = *value;
+  return 0;
+}
+
+uint32_t PixyEmulator::cam_getWBV(Chirp * chirp)
+{
+  return static_cast<PixyEmulator *>(chirp)->white_balance_value_;
+}
+
+uint32_t PixyEmulator::cam_setAEC(const uint8_t * enable, Chirp * chirp)
+{
+  static_cast<PixyEmulator *>(chirp)->auto_exposure_compensation_ = *enable;
+  return 0;
+}
+
+uint32_t PixyEmulator::cam_getAEC(Chirp * chirp)
+{
+  return static_cast<PixyEmulator *>(chirp)->auto_exposure_compensation_;
+}
+
+uint32_t PixyEmulator::cam_setECV(const uint32_t * value, Chirp * chirp)
+{
+  static_cast<PixyEmulator *>(chirp)->exposure_compensation_ = *value;
+  return 0;
+}
+
+uint32_t PixyEmulator::cam_getECV(Chirp * chirp)
+{
+  return static_cast<PixyEmulator *>(chirp)->exposure_compensation_;
+}
+
+uint32_t PixyEmulator::cam_setBrightness(const uint8_t * brightness, Chirp * chirp)
+{
+  static_cast<PixyEmulator *>(chirp)->brightness_ = *brightness;
+  return 0;
+}
+
+uint32_t PixyEmulator::cam_getBrightness(Chirp * chirp)
+{
+  return static_cast<PixyEmulator *>(chirp)->brightness_;
+}
+
+uint32_t PixyEmulator::led_set(const uint32_t * rgb, Chirp * chirp)
+{
+  static_cast<PixyEmulator *>(chirp)->led_rgb_ = *rgb;
+  return 0;
+}
+
+uint32_t PixyEmulator::led_setMaxCurrent(const uint32_t * current, Chirp * chirp)
+{
+  static_cast<PixyEmulator *>(chirp)->led_max_current_ = *current;
+  return 0;
+}
+
+uint32_t PixyEmulator::led_getMaxCurrent(Chirp * chirp)
+{
+  return static_cast<PixyEmulator *>(chirp)->led_max_current_;
+}
+
+uint32_t PixyEmulator::rcs_setPos(const uint8_t * channel, const uint16_t * position, Chirp * chirp)
+{
+  if (*channel >= PIXY_RCS_CHANNELS || *position > PIXY_RCS_MAX_POS) {
+    return -1;
+  }
+
+  static_cast<PixyEmulator *>(chirp)->rcs_position_[*channel] = *position;
+  return 0;
+}
+
+uint32_t PixyEmulator::rcs_getPos(const uint8_t * channel, Chirp * chirp)
+{
+  if (*channel >= PIXY_RCS_CHANNELS) {
+    return -1;
+  }
+
+  return static_cast<PixyEmulator *>(chirp)->rcs_position_[*channel];
+}
+
+uint32_t PixyEmulator::rcs_setFreq(const uint16_t * frequency, Chirp * chirp)
+{
+  if (*frequency < 20 || *frequency > 300) {
+    return -1;
+  }
+
+  static_cast<PixyEmulator *>(chirp)->rcs_frequency_ = *frequency;
+  return 0;
+}
+
+uint32_t PixyEmulator::version(Chirp * chirp)
+{
+  static uint16_t firmware_version[3] = { 2, 0, 19 };
+
+  CRP_RETURN(chirp, UINTS16(3, firmware_version), END);
+  return 0;
+}
+
+uint32_t PixyEmulator::emu_getCalls(Chirp * chirp)
+{
+  return static_cast<PixyEmulator *>(chirp)->calls_;
+}
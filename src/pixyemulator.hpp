@@ -0,0 +1,149 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#ifndef __PIXYEMULATOR_HPP__
+#define __PIXYEMULATOR_HPP__
+
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+#include "chirp.hpp"
+#include "memorylink.h"
+#include "pixytypes.h"
+#include "pixy.h"
+
+// Limits on the synthetic frames the emulator produces //
+#define PIXY_EMULATOR_MAX_BLOCKS    100
+#define PIXY_EMULATOR_WIDTH         320
+#define PIXY_EMULATOR_HEIGHT        200
+
+// Longest the emulator waits for a chirp before rechecking //
+// whether a frame is due or it has been asked to stop (ms). //
+#define PIXY_EMULATOR_WAIT_TIMEOUT  10
+
+/**
+  @brief  Emulates Pixy firmware as a Chirp server on an in-memory link.
+
+          Answers CRP_CALL_INIT and CRP_CALL_ENUMERATE, serves the camera,
+          LED and servo procedures and streams synthetic CCB1/CCB2 frames.
+          A PixyInterpreter talks to it through host_link() exactly as it
+          would talk to a camera over USB. Tests tell what reached it with
+          "emu_getCalls", which firmware doesn't have: the number of
+          procedure calls served, this one included.
+*/
+class PixyEmulator : public Chirp
+{
+  public:
+
+    /**
+      @param[in] frame_rate         Frames sent per second, 0 for none.
+      @param[in] normal_blocks      Blocks with normal signatures per frame.
+      @param[in] color_code_blocks  Blocks with color code signatures per frame.
+                                    When 0 frames are sent as CCB1.
+    */
+    PixyEmulator(uint32_t frame_rate, uint16_t normal_blocks, uint16_t color_code_blocks);
+    ~PixyEmulator();
+
+    /**
+      @brief  Starts serving chirps and sending frames.
+    */
+    void start();
+
+    /**
+      @brief  Stops the emulator thread.
+    */
+    void stop();
+
+    /**
+      @brief  The end of the link the host side connects to.
+    */
+    Link * host_link() { return &host_link_; }
+
+    /**
+      @brief  Number of frames sent so far.
+    */
+    uint32_t frames_sent() const { return frames_sent_; }
+
+    /**
+      @brief  When the latest frame was sent: microseconds on the
+              monotonic clock of PixyFrame::timestamp, 0 if none yet.
+    */
+    uint64_t last_frame_time() const { return last_frame_time_; }
+
+  private:
+
+    MemoryLink            link_;
+    MemoryLink            host_link_;
+    std::thread           thread_;
+    std::atomic<bool>     thread_die_;
+    std::atomic<uint32_t> frames_sent_;
+    std::atomic<uint64_t> last_frame_time_;
+    uint32_t              calls_;  // Emulator thread only
+
+    uint32_t frame_rate_;
+    uint16_t normal_blocks_;
+    uint16_t color_code_blocks_;
+    BlobA    normal_blobs_[PIXY_EMULATOR_MAX_BLOCKS];
+    BlobB    color_code_blobs_[PIXY_EMULATOR_MAX_BLOCKS];
+
+    // Emulated camera state //
+    uint8_t  auto_white_balance_;
+    uint32_t white_balance_value_;
+    uint8_t  auto_exposure_compensation_;
+    uint32_t exposure_compensation_;
+    uint8_t  brightness_;
+    uint32_t led_max_current_;
+    uint32_t led_rgb_;
+    uint16_t rcs_frequency_;
+    uint16_t rcs_position_[PIXY_RCS_CHANNELS];
+
+    /**
+      @brief  Emulator thread entry point. Services chirps from the
+              host and sends a frame whenever one is due.
+    */
+    void emulator_thread();
+
+    /**
+      @brief  Moves the synthetic blocks and sends them as one frame.
+    */
+    void send_frame();
+
+    /**
+      @brief  Counts procedure calls, then serves them as Chirp does.
+    */
+    int handleChirp(uint8_t type, ChirpProc proc, const void * args[]);
+
+    // Chirp procedures. 'chirp' is the PixyEmulator serving the call. //
+    static uint32_t cam_setAWB(const uint8_t * enable, Chirp * chirp);
+    static uint32_t cam_getAWB(Chirp * chirp);
+    static uint32_t cam_setWBV(const uint32_t * value, Chirp * chirp);
+    static uint32_t cam_getWBV(Chirp * chirp);
+    static uint32_t cam_setAEC(const uint8_t * enable, Chirp * chirp);
+    static uint32_t cam_getAEC(Chirp * chirp);
+    static uint32_t cam_setECV(const uint32_t * value, Chirp * chirp);
+    static uint32_t cam_getECV(Chirp * chirp);
+    static uint32_t cam_setBrightness(const uint8_t * brightness, Chirp * chirp);
+    static uint32_t cam_getBrightness(Chirp * chirp);
+    static uint32_t led_set(const uint32_t * rgb, Chirp * chirp);
+    static uint32_t led_setMaxCurrent(const uint32_t * current, Chirp * chirp);
+    static uint32_t led_getMaxCurrent(Chirp * chirp);
+    static uint32_t rcs_setPos(const uint8_t * channel, const uint16_t * position, Chirp * chirp);
+    static uint32_t rcs_getPos(const uint8_t * channel, Chirp * chirp);
+    static uint32_t rcs_setFreq(const uint16_t * frequency, Chirp * chirp);
+    static uint32_t version(Chirp * chirp);
+    static uint32_t emu_getCalls(Chirp * chirp);
+};
+
+#endif
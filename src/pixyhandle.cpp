@@ -20,21 +20,23 @@
 
 #include <map>
 #include <memory>
+#include <thread>
 
 #include "pixy.h"
 #include "pixyhandle.hpp"
 #include "pixyinterpreter.hpp"
+#include "proccatalog.hpp"
 
 using std::map;
 using std::shared_ptr;
 
 map<uint8_t, shared_ptr<PixyInterpreter> > interpreters_;
 
-int PixyHandle::init() 
+int PixyHandle::init(PixyThreading threading, bool fast_open) 
 {
   available_ = false;
   shared_ptr<PixyInterpreter> t_interpreter(new PixyInterpreter);
-  int init_code = t_interpreter->init();
+  int init_code = t_interpreter->init(threading, fast_open);
   if (init_code != 0) {
     return init_code;
   }
@@ -44,6 +46,48 @@ int PixyHandle::init()
   return 0;
 }
 
+int PixyHandle::init_emulated(uint32_t frame_rate, uint16_t normal_blocks, uint16_t color_code_blocks,
+                              PixyThreading threading)
+{
+  available_ = false;
+  shared_ptr<PixyInterpreter> t_interpreter(new PixyInterpreter);
+  int init_code = t_interpreter->init_emulated(frame_rate, normal_blocks, color_code_blocks, threading);
+  if (init_code != 0) {
+    return init_code;
+  }
+
+  interpreter_ = t_interpreter;
+  available_ = true;
+  return 0;
+}
+
+int PixyHandle::service(uint32_t timeout_ms) 
+{
+  if (interpreter_) {
+    return interpreter_->service(timeout_ms);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::get_pollfds(struct PixyPollfd *fds, int max_fds) 
+{
+  if (interpreter_) {
+    return interpreter_->get_pollfds(fds, max_fds);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::get_next_timeout(uint32_t *timeout_ms) 
+{
+  if (interpreter_) {
+    return interpreter_->get_next_timeout(timeout_ms);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
 int PixyHandle::get_blocks(uint16_t max_blocks, struct Block *blocks) 
 {
   if (interpreter_) {
@@ -53,6 +97,34 @@ int PixyHandle::get_blocks(uint16_t max_blocks, struct Block *blocks)
   }
 }
 
+int PixyHandle::get_frame(struct PixyFrame *frame) 
+{
+  if (interpreter_) {
+    return interpreter_->get_frame(frame);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::on_frame(FrameCallback callback) 
+{
+  if (interpreter_) {
+    interpreter_->on_frame(callback);
+    return 0;
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::frame_fd() 
+{
+  if (interpreter_) {
+    return interpreter_->frame_fd();
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
 int PixyHandle::blocks_are_new() 
 {
   if (interpreter_) {
@@ -62,6 +134,15 @@ int PixyHandle::blocks_are_new()
   }
 }
 
+int PixyHandle::wait_for_blocks(uint32_t timeout_ms) 
+{
+  if (interpreter_) {
+    return interpreter_->wait_for_blocks(timeout_ms);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
 int PixyHandle::command(const char *name, ...) 
 {
   if (interpreter_) {
@@ -94,12 +175,98 @@ int PixyHandle::command(const char *name, va_list args)
   }
 }
 
-void PixyHandle::close() 
+int PixyHandle::command(PixyPriority priority, uint32_t deadline_ms, const char *name, ...)
 {
   if (interpreter_) {
-    interpreter_->close();
+    va_list arguments;
+    int return_value;
+
+    va_start(arguments, name);
+    return_value = command(priority, deadline_ms, name, arguments);
+    va_end(arguments);
+
+    return return_value;
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::command(PixyPriority priority, uint32_t deadline_ms, const char *name, va_list args)
+{
+  if (interpreter_) {
+    va_list arguments;
+    int     return_value;
+
+    va_copy(arguments, args);
+    return_value = interpreter_->send_command(priority, deadline_ms, name, arguments);
+    va_end(arguments);
+
+    return return_value;
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::set_command_deadline(PixyPriority priority, uint32_t deadline_ms)
+{
+  if (interpreter_) {
+    return interpreter_->set_command_deadline(priority, deadline_ms);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+std::future<int> PixyHandle::command_async(AsyncCommand command)
+{
+  std::shared_ptr<std::promise<int> > result(new std::promise<int>);
+  int                                 return_value;
+
+  return_value = command_async(command, [result](int value) { result->set_value(value); });
+
+  if (return_value < 0) {
+    // Never queued, nothing else will set it //
+    result->set_value(return_value);
+  }
+
+  return result->get_future();
+}
+
+int PixyHandle::command_async(AsyncCommand command, CommandCallback callback)
+{
+  if (interpreter_) {
+    PixyInterpreter * interpreter = interpreter_.get();
+
+    return interpreter_->send_command_async([interpreter, command]() {
+      PixyHandle handle;
+
+      // Borrowed: this runs on the owner before close() stops it, //
+      // or close() drops it unrun, so the interpreter outlives it.  //
+      handle.interpreter_.reset(interpreter, [](PixyInterpreter *) {});
+      handle.available_ = true;
+
+      return command(handle);
+    }, callback);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::close() 
+{
+  int return_value;
+
+  if (interpreter_) {
+    return_value = interpreter_->close();
+
+    if (return_value < 0) {
+      // Still in use further up the calling thread's stack //
+      return return_value;
+    }
+
     interpreter_.reset();
   }
+
+  return 0;
 }
 
 void PixyHandle::error(int error_code)
@@ -132,6 +299,10 @@ int PixyHandle::led_set_RGB(uint8_t red, uint8_t green, uint8_t blue)
     // Pack the RGB value //
     RGB = blue + (green << 8) + (red << 16);
 
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_LED_RGB, RGB);
+    }
+
     return_value = command("led_set", INT32(RGB), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
    if (return_value < 0) {
@@ -139,6 +310,9 @@ int PixyHandle::led_set_RGB(uint8_t red, uint8_t green, uint8_t blue)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_LED_RGB, RGB);
+      }
       return chirp_response;
     }
   } else {
@@ -152,6 +326,10 @@ int PixyHandle::led_set_max_current(uint32_t current)
     int chirp_response;
     int return_value;
 
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_LED_MAX_CURRENT, current);
+    }
+
     return_value = command("led_setMaxCurrent", INT32(current), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
    if (return_value < 0) {
@@ -159,6 +337,9 @@ int PixyHandle::led_set_max_current(uint32_t current)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_LED_MAX_CURRENT, current);
+      }
       return chirp_response;
     }
   } else {
@@ -172,6 +353,10 @@ int PixyHandle::led_get_max_current()
     int      return_value;
     uint32_t chirp_response;
 
+    if (interpreter_->cache_lookup(PIXY_SETTING_LED_MAX_CURRENT, &chirp_response)) {
+      return chirp_response;
+    }
+
     return_value = command("led_getMaxCurrent", END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
     if (return_value < 0) {
@@ -179,6 +364,7 @@ int PixyHandle::led_get_max_current()
       return return_value;
     } else {
       // Success //
+      interpreter_->cache_store(PIXY_SETTING_LED_MAX_CURRENT, chirp_response);
       return chirp_response;
     }
   } else {
@@ -190,7 +376,11 @@ int PixyHandle::set_auto_white_balance(uint8_t enable)
 {
   if (interpreter_) {
     int      return_value;
-    uint32_t chirp_response;
+    int32_t  chirp_response;
+
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_AUTO_WHITE_BALANCE, enable);
+    }
 
     return_value = command("cam_setAWB", UINT8(enable), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
@@ -199,6 +389,9 @@ int PixyHandle::set_auto_white_balance(uint8_t enable)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_AUTO_WHITE_BALANCE, enable);
+      }
       return chirp_response;
     }
   } else {
@@ -212,6 +405,10 @@ int PixyHandle::get_auto_white_balance()
     int      return_value;
     uint32_t chirp_response;
 
+    if (interpreter_->cache_lookup(PIXY_SETTING_AUTO_WHITE_BALANCE, &chirp_response)) {
+      return chirp_response;
+    }
+
     return_value = command("cam_getAWB", END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
     if (return_value < 0) {
@@ -219,6 +416,7 @@ int PixyHandle::get_auto_white_balance()
       return return_value;
     } else {
       // Success //
+      interpreter_->cache_store(PIXY_SETTING_AUTO_WHITE_BALANCE, chirp_response);
       return chirp_response;
     }
   } else {
@@ -232,6 +430,10 @@ int PixyHandle::get_white_balance_value()
     int      return_value;
     uint32_t chirp_response;
 
+    if (interpreter_->cache_lookup(PIXY_SETTING_WHITE_BALANCE_VALUE, &chirp_response)) {
+      return chirp_response;
+    }
+
     return_value = command("cam_getWBV", END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
    if (return_value < 0) {
@@ -239,6 +441,7 @@ int PixyHandle::get_white_balance_value()
       return return_value;
     } else {
       // Success //
+      interpreter_->cache_store(PIXY_SETTING_WHITE_BALANCE_VALUE, chirp_response);
       return chirp_response;
     }
   } else {
@@ -250,18 +453,25 @@ int PixyHandle::set_white_balance_value(uint8_t red, uint8_t green, uint8_t blue
 {
   if (interpreter_) {
     int      return_value;
-    uint32_t chirp_response;
+    int32_t  chirp_response;
     uint32_t white_balance;
 
     white_balance = green + (red << 8) + (blue << 16);
 
-    return_value = command("cam_setAWB", UINT32(white_balance), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_WHITE_BALANCE_VALUE, white_balance);
+    }
+
+    return_value = command("cam_setWBV", UINT32(white_balance), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
    if (return_value < 0) {
       // Error //
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_WHITE_BALANCE_VALUE, white_balance);
+      }
       return chirp_response;
     }
   } else {
@@ -273,7 +483,11 @@ int PixyHandle::set_auto_exposure_compensation(uint8_t enable)
 {
   if (interpreter_) {
     int      return_value;
-    uint32_t chirp_response;
+    int32_t  chirp_response;
+
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_AUTO_EXPOSURE_COMPENSATION, enable);
+    }
 
     return_value = command("cam_setAEC", UINT8(enable), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
@@ -282,6 +496,9 @@ int PixyHandle::set_auto_exposure_compensation(uint8_t enable)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_AUTO_EXPOSURE_COMPENSATION, enable);
+      }
       return chirp_response;
     }
   } else {
@@ -295,6 +512,10 @@ int PixyHandle::get_auto_exposure_compensation()
     int      return_value;
     uint32_t chirp_response;
 
+    if (interpreter_->cache_lookup(PIXY_SETTING_AUTO_EXPOSURE_COMPENSATION, &chirp_response)) {
+      return chirp_response;
+    }
+
     return_value = command("cam_getAEC", END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
     if (return_value < 0) {
@@ -302,6 +523,7 @@ int PixyHandle::get_auto_exposure_compensation()
       return return_value;
     } else {
       // Success //
+      interpreter_->cache_store(PIXY_SETTING_AUTO_EXPOSURE_COMPENSATION, chirp_response);
       return chirp_response;
     }
   } else {
@@ -313,11 +535,15 @@ int PixyHandle::set_exposure_compensation(uint8_t gain, uint16_t compensation)
 {
   if (interpreter_) {
     int      return_value;
-    uint32_t chirp_response;
+    int32_t  chirp_response;
     uint32_t exposure;
 
     exposure = gain + (compensation << 8);
 
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_EXPOSURE_COMPENSATION, exposure);
+    }
+
     return_value = command("cam_setECV", UINT32(exposure), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
     if (return_value < 0) {
@@ -325,6 +551,9 @@ int PixyHandle::set_exposure_compensation(uint8_t gain, uint16_t compensation)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_EXPOSURE_COMPENSATION, exposure);
+      }
       return chirp_response;
     }
   } else {
@@ -338,11 +567,15 @@ int PixyHandle::get_exposure_compensation(uint8_t *gain, uint16_t *compensation)
     uint32_t exposure;
     int      return_value;
 
-    return_value = command("cam_getECV", END_OUT_ARGS, &exposure, END_IN_ARGS);
+    if (!interpreter_->cache_lookup(PIXY_SETTING_EXPOSURE_COMPENSATION, &exposure)) {
+      return_value = command("cam_getECV", END_OUT_ARGS, &exposure, END_IN_ARGS);
 
-    if (return_value < 0) {
-      // Chirp error //
-      return return_value;
+      if (return_value < 0) {
+        // Chirp error //
+        return return_value;
+      }
+
+      interpreter_->cache_store(PIXY_SETTING_EXPOSURE_COMPENSATION, exposure);
     }
 
     if(gain == 0 || compensation == 0) {
@@ -367,6 +600,10 @@ int PixyHandle::set_brightness(uint8_t brightness)
     int chirp_response;
     int return_value;
 
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_BRIGHTNESS, brightness);
+    }
+
     return_value = command("cam_setBrightness", UINT8(brightness), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
    if (return_value < 0) {
@@ -374,6 +611,9 @@ int PixyHandle::set_brightness(uint8_t brightness)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_BRIGHTNESS, brightness);
+      }
       return chirp_response;
     }
   } else {
@@ -384,8 +624,13 @@ int PixyHandle::set_brightness(uint8_t brightness)
 int PixyHandle::get_brightness() 
 {
   if (interpreter_) {
-    int chirp_response;
-    int return_value;
+    int      chirp_response;
+    int      return_value;
+    uint32_t cached;
+
+    if (interpreter_->cache_lookup(PIXY_SETTING_BRIGHTNESS, &cached)) {
+      return cached;
+    }
 
     return_value = command("cam_getBrightness", END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
@@ -394,6 +639,9 @@ int PixyHandle::get_brightness()
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->cache_store(PIXY_SETTING_BRIGHTNESS, chirp_response);
+      }
       return chirp_response;
     }
   } else {
@@ -404,8 +652,14 @@ int PixyHandle::get_brightness()
 int PixyHandle::rcs_get_position(uint8_t channel) 
 {
   if (interpreter_) {
-    int chirp_response;
-    int return_value;
+    int      chirp_response;
+    int      return_value;
+    uint32_t cached;
+
+    if (channel < PIXY_RCS_CHANNELS &&
+        interpreter_->cache_lookup((PixySetting) (PIXY_SETTING_RCS_POSITION_0 + channel), &cached)) {
+      return cached;
+    }
 
     return_value = command("rcs_getPos", UINT8(channel), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
@@ -414,6 +668,9 @@ int PixyHandle::rcs_get_position(uint8_t channel)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0 && channel < PIXY_RCS_CHANNELS) {
+        interpreter_->cache_store((PixySetting) (PIXY_SETTING_RCS_POSITION_0 + channel), chirp_response);
+      }
       return chirp_response;
     }
   } else {
@@ -427,6 +684,15 @@ int PixyHandle::rcs_set_position(uint8_t channel, uint16_t position)
     int chirp_response;
     int return_value;
 
+    // Setting the position by hand takes the servo off its trajectory //
+    if (channel < PIXY_RCS_CHANNELS) {
+      interpreter_->rcs_stop(channel);
+    }
+
+    if (interpreter_->coalescing() && channel < PIXY_RCS_CHANNELS) {
+      return interpreter_->post_setting((PixySetting) (PIXY_SETTING_RCS_POSITION_0 + channel), position);
+    }
+
     return_value = command("rcs_setPos", UINT8(channel), INT16(position), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
     if (return_value < 0) {
@@ -434,6 +700,9 @@ int PixyHandle::rcs_set_position(uint8_t channel, uint16_t position)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0 && channel < PIXY_RCS_CHANNELS) {
+        interpreter_->record_setting((PixySetting) (PIXY_SETTING_RCS_POSITION_0 + channel), position);
+      }
       return chirp_response;
     }
   } else {
@@ -447,6 +716,10 @@ int PixyHandle::rcs_set_frequency(uint16_t frequency)
     int chirp_response;
     int return_value;
 
+    if (interpreter_->coalescing()) {
+      return interpreter_->post_setting(PIXY_SETTING_RCS_FREQUENCY, frequency);
+    }
+
     return_value = command("rcs_setFreq", UINT16(frequency), END_OUT_ARGS, &chirp_response, END_IN_ARGS);
 
     if (return_value < 0) {
@@ -454,6 +727,9 @@ int PixyHandle::rcs_set_frequency(uint16_t frequency)
       return return_value;
     } else {
       // Success //
+      if (chirp_response >= 0) {
+        interpreter_->record_setting(PIXY_SETTING_RCS_FREQUENCY, frequency);
+      }
       return chirp_response;
     }
   } else {
@@ -461,6 +737,43 @@ int PixyHandle::rcs_set_frequency(uint16_t frequency)
   }
 }
 
+int PixyHandle::rcs_move(uint8_t channel, uint16_t position, uint32_t duration_ms)
+{
+  PixyServoWaypoint target;
+
+  target.time_ms  = duration_ms;
+  target.position = position;
+
+  return rcs_stream(channel, &target, 1);
+}
+
+int PixyHandle::rcs_stream(uint8_t channel, const struct PixyServoWaypoint *waypoints, int count)
+{
+  if (interpreter_) {
+    return interpreter_->rcs_stream(channel, waypoints, count);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::rcs_stop(uint8_t channel)
+{
+  if (interpreter_) {
+    return interpreter_->rcs_stop(channel);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::rcs_set_stream_rate(uint16_t rate)
+{
+  if (interpreter_) {
+    return interpreter_->rcs_set_stream_rate(rate);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
 int PixyHandle::num_pixies_attached() 
 {
   return USBLink::numDevices();
@@ -471,6 +784,71 @@ int PixyHandle::num_pixies_in_use()
   return USBLink::numDevicesInUse();
 }
 
+int PixyHandle::init_all(std::vector<PixyHandle> &handles, PixyThreading threading, bool fast_open)
+{
+  int count;
+
+  handles.clear();
+
+  count = num_pixies_attached();
+
+  if (count <= 0) {
+    return count;
+  }
+
+  // Each opener claims whichever camera is still free, so the slow //
+  // USB reset and Chirp handshake of every camera overlap          //
+  return open_all(handles, count, [threading, fast_open](PixyHandle &pixy) {
+    return pixy.init(threading, fast_open);
+  });
+}
+
+int PixyHandle::open_all(std::vector<PixyHandle> &handles, int count, Opener open)
+{
+  std::vector<std::thread> openers;
+  std::vector<PixyHandle>  opened;
+  std::vector<int>         results;
+  int                      index;
+  int                      error;
+
+  handles.clear();
+
+  if (count <= 0) {
+    return count;
+  }
+
+  opened.resize(count);
+  results.resize(count);
+
+  for (index = 0; index != count; ++index) {
+    openers.push_back(std::thread([&opened, &results, &open, index] {
+      results[index] = open(opened[index]);
+    }));
+  }
+
+  for (index = 0; index != count; ++index) {
+    openers[index].join();
+  }
+
+  error = 0;
+  for (index = 0; index != count; ++index) {
+    if (results[index] == 0) {
+      handles.push_back(opened[index]);
+    } else {
+      // 'open' may have failed after opening the camera //
+      opened[index].close();
+      error = results[index];
+    }
+  }
+
+  return handles.empty() ? error : (int) handles.size();
+}
+
+void PixyHandle::set_procedure_catalog(const char *directory)
+{
+  ProcCatalog::set_directory(directory);
+}
+
 int PixyHandle::get_firmware_version(uint16_t *major, uint16_t *minor, uint16_t *build) 
 {
   if (interpreter_) {
@@ -504,3 +882,32 @@ int PixyHandle::get_firmware_version(uint16_t *major, uint16_t *minor, uint16_t
     return PIXY_ERROR_UNINITIALIZED;
   }
 }
+
+int PixyHandle::set_receive_queue(uint8_t transfers)
+{
+  if (interpreter_) {
+    return interpreter_->set_receive_queue(transfers);
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::set_coalescing(bool enable)
+{
+  if (interpreter_) {
+    interpreter_->set_coalescing(enable);
+    return 0;
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
+
+int PixyHandle::set_settings_cache(bool enable)
+{
+  if (interpreter_) {
+    interpreter_->set_caching(enable);
+    return 0;
+  } else {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+}
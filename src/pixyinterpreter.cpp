@@ -17,162 +17,1333 @@
 #include <stdio.h>
 #include <memory>
 #include <map>
+#include <chrono>
+#include <future>
 #include "pixyinterpreter.hpp"
+#include "debuglog.h"
 
 #if defined(_WIN32) || defined(_WIN64)
   #include "usleep.h"
 #endif
 
+#ifdef __LINUX__
+  #include <sys/eventfd.h>
+#endif
+
+// Host arrival time stamps: microseconds on a monotonic clock //
+static uint64_t host_time()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Receive buffer a thread got back with its last posted command. //
+// The results of that command point into it.                     //
+struct ResponseBuffer
+{
+  ResponseBuffer() : data(0), size(0) {}
+  ~ResponseBuffer() { delete[] data; }
+
+  uint8_t * data;
+  uint32_t  size;
+};
+
+static thread_local ResponseBuffer response_buffer;
+
+// Procedures that are not PIXY_PRIORITY_NORMAL //
+struct ProcedurePriority
+{
+  const char * name;
+  PixyPriority priority;
+};
+
+static const ProcedurePriority PROCEDURE_PRIORITIES[] = {
+  { "rcs_setPos",        PIXY_PRIORITY_HIGH },
+  { "led_set",           PIXY_PRIORITY_LOW  },
+  { "led_setMaxCurrent", PIXY_PRIORITY_LOW  },
+  { "led_getMaxCurrent", PIXY_PRIORITY_LOW  },
+  { "version",           PIXY_PRIORITY_LOW  },
+};
+
+// Whether 'command' is past its deadline //
+static bool expired(const PixyCommand * command)
+{
+  return command->deadline != 0 && host_time() > command->deadline;
+}
+
 PixyInterpreter::PixyInterpreter()
 {
-  thread_die_  = false;
-  thread_dead_ = true;
-  receiver_    = NULL;
+  thread_die_  = false;
+  thread_dead_ = true;
+  receiver_    = NULL;
+  emulator_    = NULL;
+  link_        = &usb_link_;
+
+  frame_sequence_     = 0;
+  last_read_sequence_ = 0;
+  frame_waiters_      = 0;
+  frame_fd_           = -1;
+  inline_             = false;
+  shared_             = false;
+
+  dispatch_frames_   = false;
+  in_frame_callback_ = false;
+  deferred_sequence_ = 0;
+  cataloging_        = false;
+
+  accepting_commands_ = false;
+  command_callers_    = 0;
+
+  for (int priority = 0; priority != PIXY_PRIORITY_CLASSES; ++priority) {
+    class_deadlines_[priority] = 0;
+  }
+
+  coalescing_       = false;
+  caching_          = false;
+  pending_settings_ = 0;
+  for (int setting = 0; setting != PIXY_SETTING_COUNT; ++setting) {
+    pending_values_[setting] = 0;
+  }
+}
+
+PixyInterpreter::~PixyInterpreter()
+{
+  close();
+
+#ifdef __LINUX__
+  if (frame_fd_ >= 0) {
+    ::close(frame_fd_);
+  }
+#endif
+}
+
+int PixyInterpreter::init(PixyThreading threading, bool fast_open)
+{
+  int USB_return_value;
+
+  if(thread_dead_ == false || inline_ || shared_) 
+  {
+    fprintf(stderr, "libpixy: Already initialized.\n");
+    return 0;
+  }
+
+  usb_link_.setFastOpen(fast_open);
+
+  USB_return_value = usb_link_.open();
+
+  if(USB_return_value < 0) {
+    return USB_return_value;
+  }
+
+  return start(&usb_link_, threading);
+}
+
+int PixyInterpreter::init_emulated(uint32_t frame_rate, uint16_t normal_blocks, uint16_t color_code_blocks, PixyThreading threading)
+{
+  if(thread_dead_ == false || inline_ || shared_) 
+  {
+    fprintf(stderr, "libpixy: Already initialized.\n");
+    return 0;
+  }
+
+  // The emulator must be serving before the receiver connects //
+  emulator_ = new PixyEmulator(frame_rate, normal_blocks, color_code_blocks);
+  emulator_->start();
+
+  return start(emulator_->host_link(), threading);
+}
+
+int PixyInterpreter::start(Link * link, PixyThreading threading)
+{
+  link_ = link;
+
+  // Procedure ids are assigned per connection //
+  procedures_.clear();
+
+  create_receiver();
+
+  if (receiver_->connected()) {
+    load_procedures();
+  }
+
+  accepting_commands_ = true;
+
+  if (threading == PIXY_THREAD_NONE) {
+    // The application calls service() itself //
+    inline_ = true;
+    return 0;
+  }
+
+  // The service thread waits on USB events only, other links keep //
+  // a thread of their own.                                        //
+  if (threading == PIXY_THREAD_SHARED && using_usb()) {
+    shared_ = true;
+    PixyService::attach(this);
+    return 0;
+  }
+
+  // Create the interpreter thread //
+
+  thread_dead_ = false;
+  thread_      = std::thread(&PixyInterpreter::interpreter_thread, this);
+
+  return 0;
+}
+
+int PixyInterpreter::close()
+{
+  if (servicing_.load() == std::this_thread::get_id()) {
+    return PIXY_ERROR_IN_CALLBACK;
+  }
+
+  // Coalesced settings go out while the owner and the link are still //
+  // up: the owner flushes them before it runs a posted command.      //
+  if (pending_settings_.load() != 0) {
+    if (inline_) {
+      flush_settings();
+    } else if (thread_.joinable() || shared_) {
+      std::promise<int> flushed;
+
+      if (send_command_async([] { return 0; },
+                             [&flushed](int result) { flushed.set_value(result); }) == 0) {
+        flushed.get_future().wait();
+      }
+    }
+  }
+
+  // The owner of the receiver is about to stop //
+  accepting_commands_ = false;
+
+  // Wake the owner from whatever it sleeps or blocks on: the stop //
+  // signal ends its idle waits, cancelling the link its receives.  //
+  stop_mutex_.lock();
+  thread_die_ = true;
+  stop_mutex_.unlock();
+  stop_requested_.notify_all();
+  link_->cancel();
+
+  if (shared_) {
+    PixyService::detach(this);
+    shared_ = false;
+  }
+
+  // Is the interpreter thread alive? //
+  if(thread_.joinable()) 
+  {
+    thread_.join();
+  }
+
+  // Nobody services the link anymore and it no longer receives. //
+  // Release the senders of whatever was posted, without running it. //
+  owner_ = std::this_thread::get_id();
+
+  while (command_callers_ > 0) {
+    if (abandon_commands() == 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Posted while close() ran, too late to send //
+  pending_settings_ = 0;
+
+  owner_ = std::thread::id();
+
+  cache_.clear();
+  
+  if (receiver_)  
+  {
+    delete receiver_;
+    receiver_ = NULL;
+  }
+
+  // Stopped last, the receiver says goodbye to it on delete //
+  if (emulator_)
+  {
+    delete emulator_;
+    emulator_ = NULL;
+  }
+
+  inline_ = false;
+
+  link_ = &usb_link_;
+
+  thread_die_ = false;
+
+  return 0;
+}
+
+int PixyInterpreter::get_blocks(int max_blocks, Block * blocks)
+{
+  uint16_t number_of_blocks_to_copy;
+
+  // Check parameters //
+
+  if(max_blocks < 0 || blocks == 0) {
+    return PIXY_ERROR_INVALID_PARAMETER;
+  }
+
+  // Readers take turns with each other, never with the interpreter thread. //
+
+  frame_read_mutex_.lock();
+
+  // Pick up the latest frame, if any was published since the last call //
+  frames_.update();
+
+  const BlockFrame & frame = frames_.front();
+
+  last_read_sequence_ = frame.sequence;
+
+  number_of_blocks_to_copy = (max_blocks >= frame.count ? frame.count : max_blocks);
+
+  // Copy blocks //
+
+  memcpy(blocks, frame.blocks, number_of_blocks_to_copy * sizeof(Block));
+
+  frame_read_mutex_.unlock();
+
+  return number_of_blocks_to_copy;
+}
+
+int PixyInterpreter::get_frame(PixyFrame * frame)
+{
+  bool is_new;
+
+  if (frame == 0) {
+    return PIXY_ERROR_INVALID_PARAMETER;
+  }
+
+  frame_read_mutex_.lock();
+
+  is_new = frames_.update();
+
+  const BlockFrame & latest = frames_.front();
+
+  frame->sequence  = latest.sequence;
+  frame->timestamp = latest.timestamp;
+
+  // Every sequence number between this frame and the previous one //
+  // read was published and then overwritten before anyone read it. //
+  if (is_new && latest.sequence > last_read_sequence_ + 1) {
+    frame->dropped = latest.sequence - last_read_sequence_ - 1;
+  } else {
+    frame->dropped = 0;
+  }
+
+  last_read_sequence_ = latest.sequence;
+
+  // The frame's own blocks are the newest ones in the buffer //
+  frame->number_of_blocks = latest.frame_count;
+  memcpy(frame->blocks, latest.blocks + latest.count - latest.frame_count,
+         latest.frame_count * sizeof(Block));
+
+  frame_read_mutex_.unlock();
+
+  return is_new ? 1 : 0;
+}
+
+int PixyInterpreter::send_command(const char * name, ...)
+{
+  va_list arguments;
+  int     return_value;
+
+  va_start(arguments, name);
+  return_value = send_command(name, arguments);
+  va_end(arguments);
+
+  return return_value;
+}
+
+int PixyInterpreter::send_command(const char * name, va_list arguments)
+{
+  return send_command(procedure_priority(name), 0, name, arguments);
+}
+
+int PixyInterpreter::send_command(PixyPriority priority, uint32_t deadline_ms, const char * name, va_list arguments)
+{
+  uint64_t deadline;
+  int      return_value;
+
+  if (priority < 0 || priority >= PIXY_PRIORITY_CLASSES) {
+    return PIXY_ERROR_INVALID_PARAMETER;
+  }
+
+  if (deadline_ms == 0) {
+    deadline_ms = class_deadlines_[priority];
+  }
+
+  deadline = deadline_ms ? host_time() + deadline_ms * 1000ULL : 0;
+
+  // Inline, any thread may talk to Pixy and the mutex takes turns //
+  if (inline_ || owner_.load() == std::this_thread::get_id()) {
+    chirp_access_mutex_.lock();
+
+    if (deadline != 0 && host_time() > deadline) {
+      // Waited too long for another thread's command //
+      return_value = PIXY_ERROR_TIMEOUT;
+    } else {
+      // Settings coalesced before this command go first //
+      flush_settings();
+
+      return_value = execute_command(name, arguments);
+    }
+
+    chirp_access_mutex_.unlock();
+
+    return return_value;
+  }
+
+  return post_command(priority, deadline, name, arguments);
+}
+
+int PixyInterpreter::set_command_deadline(PixyPriority priority, uint32_t deadline_ms)
+{
+  if (priority < 0 || priority >= PIXY_PRIORITY_CLASSES) {
+    return PIXY_ERROR_INVALID_PARAMETER;
+  }
+
+  class_deadlines_[priority] = deadline_ms;
+
+  return 0;
+}
+
+PixyPriority PixyInterpreter::procedure_priority(const char * name)
+{
+  size_t index;
+
+  for (index = 0; index != sizeof(PROCEDURE_PRIORITIES) / sizeof(PROCEDURE_PRIORITIES[0]); ++index) {
+    if (strcmp(PROCEDURE_PRIORITIES[index].name, name) == 0) {
+      return PROCEDURE_PRIORITIES[index].priority;
+    }
+  }
+
+  return PIXY_PRIORITY_NORMAL;
+}
+
+int PixyInterpreter::post_command(PixyPriority priority, uint64_t deadline, const char * name, va_list arguments)
+{
+  PixyCommand command;
+
+  command.name     = name;
+  command.priority = priority;
+  command.deadline = deadline;
+  va_copy(command.arguments, arguments);
+
+  // Traded for the receive buffer holding the response //
+  command.buffer      = response_buffer.data;
+  command.buffer_size = response_buffer.size;
+
+  // Turned away without holding up close() //
+  if (!accepting_commands_) {
+    va_end(command.arguments);
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+
+  // close() waits for every sender that gets past this check //
+  command_callers_++;
+
+  if (!accepting_commands_) {
+    command_callers_--;
+    va_end(command.arguments);
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+
+  commands_.push(&command);
+
+  // Cut the owner's wait for USB data short //
+  link_->wake();
+
+  std::unique_lock<std::mutex> lock(command_mutex_);
+  command_done_.wait(lock, [&command] { return command.done; });
+  lock.unlock();
+
+  response_buffer.data = command.buffer;
+  response_buffer.size = command.buffer_size;
+
+  va_end(command.arguments);
+  command_callers_--;
+
+  return command.result;
+}
+
+int PixyInterpreter::send_command_async(AsyncCommand command, CommandCallback callback)
+{
+  PixyCommand * posted;
+
+  if (!accepting_commands_) {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+
+  command_callers_++;
+
+  if (!accepting_commands_) {
+    command_callers_--;
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+
+  // Freed by run_commands() //
+  posted           = new PixyCommand;
+  posted->work     = command;
+  posted->callback = callback;
+
+  commands_.push(posted);
+  link_->wake();
+
+  return 0;
+}
+
+int PixyInterpreter::run_commands()
+{
+  PixyCommand * batch[PIXY_COMMAND_PIPELINE];
+  PixyCommand * command;
+  int           batched;
+  int           count;
+  int           priority;
+  int           result;
+
+  count = 0;
+
+  for (;;) {
+    // Commands posted meanwhile may outrank the ones waiting //
+    while ((command = commands_.pop()) != 0) {
+      ready_[command->priority].push_back(command);
+      count++;
+    }
+
+    for (priority = 0; priority != PIXY_PRIORITY_CLASSES && ready_[priority].empty(); ++priority) {
+    }
+
+    if (priority == PIXY_PRIORITY_CLASSES) {
+      break;
+    }
+
+    std::deque<PixyCommand *> & ready = ready_[priority];
+
+    if (!ready.front()->work) {
+      // Calls posted together go out together //
+      batched = 0;
+      while (!ready.empty() && !ready.front()->work && batched != PIXY_COMMAND_PIPELINE) {
+        batch[batched++] = ready.front();
+        ready.pop_front();
+      }
+
+      execute_batch(batch, batched);
+      continue;
+    }
+
+    // Calls of its class posted before it completed first //
+    command = ready.front();
+    ready.pop_front();
+
+    // Settings the sender coalesced before posting this too //
+    flush_settings();
+
+    // Runs on this thread, so its commands execute directly //
+    result = command->work();
+
+    if (command->callback) {
+      command->callback(result);
+    }
+
+    delete command;
+    command_callers_--;
+  }
+
+  return count;
+}
+
+int PixyInterpreter::abandon_commands()
+{
+  PixyCommand * command;
+  int           count;
+  int           priority;
+
+  count = 0;
+
+  while ((command = commands_.pop()) != 0) {
+    ready_[command->priority].push_back(command);
+  }
+
+  for (priority = 0; priority != PIXY_PRIORITY_CLASSES; ++priority) {
+    while (!ready_[priority].empty()) {
+      command = ready_[priority].front();
+      ready_[priority].pop_front();
+      count++;
+
+      if (command->work) {
+        if (command->callback) {
+          command->callback(PIXY_ERROR_UNINITIALIZED);
+        }
+
+        delete command;
+        command_callers_--;
+        continue;
+      }
+
+      // The sender owns 'command' again once it is done //
+      command_mutex_.lock();
+      command->result = PIXY_ERROR_UNINITIALIZED;
+      command->done   = true;
+      command_mutex_.unlock();
+    }
+  }
+
+  command_done_.notify_all();
+
+  return count;
+}
+
+void PixyInterpreter::execute_batch(PixyCommand * batch[], int count)
+{
+  ChirpCall     calls[PIXY_COMMAND_PIPELINE];
+  PixyCommand * called[PIXY_COMMAND_PIPELINE];
+  ChirpProc     procedure_id;
+  int           calls_made;
+  int           index;
+
+  if (count == 0) {
+    return;
+  }
+
+  // Settings coalesced before the calls were posted go first //
+  flush_settings();
+
+  chirp_access_mutex_.lock();
+
+  if (count == 1 || (using_usb() && !usb_link_.queued())) {
+    // Without the receive queue nobody takes Pixy's responses //
+    // while we send, so one call at a time.                   //
+    for (index = 0; index != count; ++index) {
+      // Stale by now, drop it rather than act on it late //
+      if (expired(batch[index])) {
+        batch[index]->result = PIXY_ERROR_TIMEOUT;
+        continue;
+      }
+
+      batch[index]->result = execute_command(batch[index]->name, batch[index]->arguments);
+
+      // Returned arrays point into the receive buffer, so the sender //
+      // takes it along and the receiver goes on with the sender's.   //
+      receiver_->swapBuffer(&batch[index]->buffer, &batch[index]->buffer_size);
+    }
+  } else {
+    calls_made = 0;
+
+    // Enumerate first, nothing may be in flight meanwhile //
+    for (index = 0; index != count; ++index) {
+      if (expired(batch[index])) {
+        batch[index]->result = PIXY_ERROR_TIMEOUT;
+        continue;
+      }
+
+      procedure_id = get_procedure(batch[index]->name);
+
+      if (procedure_id < 0) {
+        batch[index]->result = PIXY_ERROR_INVALID_COMMAND;
+        continue;
+      }
+
+      calls[calls_made].proc    = procedure_id;
+      calls[calls_made].args    = &batch[index]->arguments;
+      calls[calls_made].buf     = batch[index]->buffer;
+      calls[calls_made].bufSize = batch[index]->buffer_size;
+      called[calls_made]        = batch[index];
+      calls_made++;
+    }
+
+    // All of them in about one round trip //
+    receiver_->callPipelined(calls, calls_made);
+
+    for (index = 0; index != calls_made; ++index) {
+      called[index]->result      = calls[index].result;
+      called[index]->buffer      = calls[index].buf;
+      called[index]->buffer_size = calls[index].bufSize;
+    }
+  }
+
+  chirp_access_mutex_.unlock();
+
+  command_mutex_.lock();
+  for (index = 0; index != count; ++index) {
+    batch[index]->done = true;
+  }
+  command_mutex_.unlock();
+  command_done_.notify_all();
+}
+
+int PixyInterpreter::execute_command(const char * name, ...)
+{
+  va_list arguments;
+  int     return_value;
+
+  va_start(arguments, name);
+  return_value = execute_command(name, arguments);
+  va_end(arguments);
+
+  return return_value;
+}
+
+int PixyInterpreter::execute_command(const char * name, va_list args)
+{
+  ChirpProc procedure_id;
+  int       return_value;
+  va_list   arguments;
+
+  bool      dispatching;
+
+  va_copy(arguments, args);
+
+  // Mutual exclusion for receiver_ object (Lock) //
+  chirp_access_mutex_.lock();
+
+  // Frames that arrive while we wait for the response are not reported: //
+  // a command issued from the callback must not nest inside this one.   //
+  dispatching      = dispatch_frames_;
+  dispatch_frames_ = false;
+
+  // Request chirp procedure id for 'name'. //
+  procedure_id = get_procedure(name);
+
+  // Was there an error requesting procedure id? //
+  if (procedure_id < 0) {
+    // Request error //
+    va_end(arguments);
+
+    dispatch_frames_ = dispatching;
+
+    // Mutual exclusion for receiver_ object (Unlock) //
+    chirp_access_mutex_.unlock();
+
+    return PIXY_ERROR_INVALID_COMMAND;
+  }
+
+  // Execute chirp synchronous remote procedure call //
+  return_value = receiver_->call(SYNC, procedure_id, arguments); 
+  va_end(arguments);
+
+  dispatch_frames_ = dispatching;
+
+  // Mutual exclusion for receiver_ object (Unlock) //
+  chirp_access_mutex_.unlock();
+
+  return return_value;
+}
+
+void PixyInterpreter::on_frame(FrameCallback callback)
+{
+  // Frames are reported with this mutex held //
+  chirp_access_mutex_.lock();
+  frame_callback_ = callback;
+  chirp_access_mutex_.unlock();
+}
+
+int PixyInterpreter::frame_fd()
+{
+#ifdef __LINUX__
+  int fd;
+
+  // Readers may race to create it //
+  frame_read_mutex_.lock();
+
+  if (frame_fd_ < 0) {
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd >= 0) {
+      frame_fd_ = fd;
+    }
+  }
+
+  fd = frame_fd_;
+  frame_read_mutex_.unlock();
+
+  return fd >= 0 ? fd : PIXY_ERROR_USB_IO;
+#else
+  return PIXY_ERROR_UNSUPPORTED;
+#endif
+}
+
+int PixyInterpreter::set_receive_queue(uint8_t transfers)
+{
+  int return_value;
+
+  // The link must not be receiving while its queue is rebuilt //
+  chirp_access_mutex_.lock();
+  return_value = usb_link_.setReceiveQueue(transfers);
+  chirp_access_mutex_.unlock();
+
+  return return_value;
+}
+
+int PixyInterpreter::set_response_tags(bool enable)
+{
+  chirp_access_mutex_.lock();
+
+  if (receiver_ == NULL) {
+    chirp_access_mutex_.unlock();
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+
+  // Tags are handed out when a procedure is enumerated //
+  receiver_->setResponseTags(enable);
+  procedures_.clear();
+
+  chirp_access_mutex_.unlock();
+
+  return 0;
+}
+
+void PixyInterpreter::load_procedures()
+{
+  uint16_t *  pixy_version;
+  uint32_t    version_length;
+  uint32_t    response;
+  size_t      index;
+
+  chirp_access_mutex_.lock();
+
+  cataloging_ = false;
+
+  if (!ProcCatalog::enabled()) {
+    chirp_access_mutex_.unlock();
+    return;
+  }
+
+  // Cataloged procedures are never enumerated on this connection, so //
+  // Pixy tags their responses with whatever it was told before       //
+  receiver_->setResponseTags(false);
+
+  if (execute_command("version", END_OUT_ARGS, &response, &version_length, &pixy_version, END_IN_ARGS) < 0 ||
+      version_length < 3) {
+    chirp_access_mutex_.unlock();
+    return;
+  }
+
+  // Points into the receive buffer, the next call overwrites it //
+  memcpy(catalog_version_, pixy_version, sizeof(catalog_version_));
+
+  // First connect to this firmware starts an empty catalog //
+  catalog_.load(catalog_version_[0], catalog_version_[1], catalog_version_[2]);
+
+  for (index = 0; index != catalog_.entries().size(); ++index) {
+    procedures_[catalog_.entries()[index].name] = catalog_.entries()[index].id;
+  }
+
+  cataloging_ = true;
+
+  if (catalog_.add(receiver_, "version", procedures_["version"])) {
+    catalog_.save(catalog_version_[0], catalog_version_[1], catalog_version_[2]);
+  }
+
+  chirp_access_mutex_.unlock();
+}
+
+ChirpProc PixyInterpreter::get_procedure(const char * name)
+{
+  std::map<std::string, ChirpProc>::const_iterator cached;
+  ChirpProc                                        procedure_id;
+
+  cached = procedures_.find(name);
+
+  if (cached != procedures_.end()) {
+    return cached->second;
+  }
+
+  // Not seen on this connection yet, ask Pixy. //
+  procedure_id = receiver_->getProc(name);
+
+  // Only remember successful lookups so a transient //
+  // enumeration failure is retried on the next call. //
+  if (procedure_id >= 0) {
+    procedures_[name] = procedure_id;
+
+    if (cataloging_ && catalog_.add(receiver_, name, procedure_id)) {
+      catalog_.save(catalog_version_[0], catalog_version_[1], catalog_version_[2]);
+    }
+  }
+
+  return procedure_id;
+}
+
+void PixyInterpreter::interpreter_thread()
+{
+  thread_dead_ = false;
+  // Read from Pixy USB connection using the Chirp //
+  // protocol until we're told to stop.            //
+  while(!thread_die_) {
+    if (service_link(PIXY_INTERPRETER_WAIT_TIMEOUT) > 0 &&
+        using_usb() && !usb_link_.queued()) {
+      // Synchronous receive: no events to sleep on, poll //
+      idle(15);
+    }
+  }
+
+  thread_dead_ = true;
+}
+
+void PixyInterpreter::idle(uint32_t wait_ms)
+{
+  std::unique_lock<std::mutex> lock(stop_mutex_);
+
+  stop_requested_.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                           [this] { return thread_die_.load(); });
+}
+
+int PixyInterpreter::service_link(uint32_t timeout_ms)
+{
+  int serviced;
+  int ready;
+  int worked;
+
+  // Whoever services the link owns the receiver //
+  owner_     = std::this_thread::get_id();
+  servicing_ = std::this_thread::get_id();
+
+  if (!connected()) {
+    reconnect(timeout_ms < PIXY_RECONNECT_INTERVAL ? timeout_ms : PIXY_RECONNECT_INTERVAL);
+    run_commands();
+    servicing_ = std::thread::id();
+    return 0;
+  }
+
+  // Sleep until the receive queue has data for us, a command is //
+  // posted or a servo update is due                              //
+  timeout_ms = wait_limit(timeout_ms);
+  ready      = link_->waitForData(timeout_ms < 0xffff ? timeout_ms : 0xffff);
+
+  stream_servos();
+
+  // Settings and commands go first, their senders are waiting. Frames //
+  // arriving meanwhile are decoded by the calls, so look for data again. //
+  do {
+    worked  = flush_settings();
+    worked += run_commands();
+
+    if (worked > 0) {
+      ready = link_->waitForData(0);
+    }
+  } while (worked > 0);
+
+  if (ready == 0) {
+    servicing_ = std::thread::id();
+    return 0;
+  }
+
+  // Mutual exclusion for receiver_ object (Lock) //
+  chirp_access_mutex_.lock();
+
+  // Drain every chirp that has arrived before sleeping again, //
+  // reporting each frame to the callback as it is decoded.    //
+  dispatch_frames_ = true;
+  serviced         = 0;
+  do {
+    receiver_->service(false);
+    serviced++;
+  } while (link_->pending() > 0);
+  dispatch_frames_ = false;
+
+  // Mutual exclusion for receiver_ object (Unlock) //
+  chirp_access_mutex_.unlock();
+
+  servicing_ = std::thread::id();
+
+  return serviced;
+}
+
+int PixyInterpreter::service(uint32_t timeout_ms)
+{
+  if (!inline_) {
+    // The interpreter thread is doing this already //
+    return PIXY_ERROR_INITIALIZED;
+  }
+
+  return service_link(timeout_ms);
 }
 
-PixyInterpreter::~PixyInterpreter()
+int PixyInterpreter::get_pollfds(PixyPollfd * fds, int max_fds)
 {
-  close();
+  std::vector<libusb_pollfd> usb_fds;
+  int                        return_value;
+  int                        index;
+
+  if (fds == 0 || max_fds < 0) {
+    return PIXY_ERROR_INVALID_PARAMETER;
+  }
+
+  if (!using_usb()) {
+    return PIXY_ERROR_UNSUPPORTED;
+  }
+
+  return_value = usb_link_.pollfds(usb_fds);
+
+  if (return_value == LIBUSB_ERROR_NOT_SUPPORTED) {
+    return PIXY_ERROR_UNSUPPORTED;
+  } else if (return_value < 0) {
+    return return_value;
+  }
+
+  for (index = 0; index != (int) usb_fds.size() && index != max_fds; ++index) {
+    fds[index].fd     = usb_fds[index].fd;
+    fds[index].events = usb_fds[index].events;
+  }
+
+  // Report how many there are, so a short array can be grown //
+  return usb_fds.size();
 }
 
-int PixyInterpreter::init()
+int PixyInterpreter::get_next_timeout(uint32_t * timeout_ms)
 {
-  int USB_return_value;
+  int      return_value;
+  uint32_t servo_ms;
 
-  if(thread_dead_ == false) 
-  {
-    fprintf(stderr, "libpixy: Already initialized.\n");
-    return 0;
+  if (timeout_ms == 0) {
+    return PIXY_ERROR_INVALID_PARAMETER;
   }
 
-  USB_return_value = link_.open();
+  if (!using_usb()) {
+    return PIXY_ERROR_UNSUPPORTED;
+  }
 
-  if(USB_return_value < 0) {
-    return USB_return_value;
+  if (usb_link_.lost()) {
+    // No fd will fire for a missing camera, look for it periodically //
+    *timeout_ms = PIXY_RECONNECT_INTERVAL;
+    return 1;
   }
 
-  receiver_ = new ChirpReceiver(&link_, this);
+  return_value = usb_link_.nextTimeout(timeout_ms);
 
-  // Create the interpreter thread //
+  if (return_value < 0) {
+    return return_value;
+  }
 
-  thread_dead_ = false;
-  thread_      = std::thread(&PixyInterpreter::interpreter_thread, this);
+  // A servo update may be due before libusb needs us //
+  servo_ms = servos_.next_update(host_time());
 
-  return 0;
+  if (servo_ms != 0xffffffff && (return_value == 0 || servo_ms < *timeout_ms)) {
+    *timeout_ms  = servo_ms;
+    return_value = 1;
+  }
+
+  return return_value;
 }
 
-void PixyInterpreter::close()
+
+bool PixyInterpreter::connected()
 {
-  // Is the interpreter thread alive? //
-  if(thread_.joinable()) 
-  {
-    // Thread is running, tell the interpreter thread to die. //
-    thread_die_ = true;
-    thread_.join();
+  bool is_connected;
+
+  chirp_access_mutex_.lock();
+  is_connected = !(using_usb() && usb_link_.lost()) && receiver_->connected();
+  chirp_access_mutex_.unlock();
+
+  return is_connected;
+}
+
+void PixyInterpreter::reconnect(uint32_t wait_ms)
+{
+  bool is_connected;
+
+  chirp_access_mutex_.lock();
+
+  // Tear down the old session and try to reclaim the camera //
+  delete receiver_;
+  procedures_.clear();
+
+  // Pixy may have been reset or changed meanwhile //
+  cache_.clear();
+
+  if (using_usb() && usb_link_.reopen() < 0) {
+    log("pixydebug: PixyInterpreter::reconnect() camera not present\n");
   }
-  
-  if (receiver_)  
-  {
+
+  // A receiver always exists; it stays disconnected if the link is down //
+  create_receiver();
+  is_connected = receiver_->connected();
+
+  chirp_access_mutex_.unlock();
+
+  if (is_connected) {
+    load_procedures();
+    restore_settings();
+
+    if (caching_) {
+      fill_cache();
+    }
+  } else {
+    // Nothing to talk to yet, wait for the camera to come back //
+    if (using_usb()) {
+      usb_link_.waitForArrival(wait_ms);
+    } else {
+      idle(wait_ms);
+    }
+  }
+}
+
+void PixyInterpreter::create_receiver()
+{
+  receiver_ = new ChirpReceiver(link_, this);
+
+  // Fast open trusted the camera to be in a clean state. If it does //
+  // not answer, give it the reset it was spared and try again.      //
+  if (!receiver_->connected() && using_usb() && usb_link_.resetSkipped()) {
+    log("pixydebug: PixyInterpreter::create_receiver() resetting camera\n");
+
     delete receiver_;
-    receiver_ = NULL;
+    usb_link_.reset();
+    receiver_ = new ChirpReceiver(link_, this);
   }
 }
 
-int PixyInterpreter::get_blocks(int max_blocks, Block * blocks)
+void PixyInterpreter::restore_settings()
 {
-  uint16_t number_of_blocks_to_copy;
-  uint16_t index;
+  int      setting;
+  uint32_t values[PIXY_SETTING_COUNT];
+  bool     recorded[PIXY_SETTING_COUNT];
 
-  // Check parameters //
+  // Taken up front, recording one setting may forget another //
+  for (setting = 0; setting != PIXY_SETTING_COUNT; ++setting) {
+    recorded[setting] = settings_.get((PixySetting) setting, &values[setting]);
+  }
 
-  if(max_blocks < 0 || blocks == 0) {
+  for (setting = 0; setting != PIXY_SETTING_COUNT; ++setting) {
+    if (recorded[setting]) {
+      apply_setting((PixySetting) setting, values[setting]);
+    }
+  }
+}
+
+int PixyInterpreter::post_setting(PixySetting setting, uint32_t value)
+{
+  if (!accepting_commands_) {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+
+  queue_setting(setting, value);
+
+  link_->wake();
+
+  return 0;
+}
+
+void PixyInterpreter::queue_setting(PixySetting setting, uint32_t value)
+{
+  // Overwrites a value that was not sent yet //
+  pending_values_[setting].store(value);
+  pending_settings_.fetch_or(1u << setting);
+}
+
+int PixyInterpreter::rcs_stream(uint8_t channel, const PixyServoWaypoint * waypoints, int count)
+{
+  uint32_t recorded;
+  int      from;
+  int      return_value;
+
+  if (!accepting_commands_) {
+    return PIXY_ERROR_UNINITIALIZED;
+  }
+
+  // Start from the last position set by hand, if any //
+  from = -1;
+  if (channel < PIXY_RCS_CHANNELS &&
+      settings_.get((PixySetting) (PIXY_SETTING_RCS_POSITION_0 + channel), &recorded)) {
+    from = recorded;
+  }
+
+  return_value = servos_.stream(channel, waypoints, count, from, host_time());
+
+  if (return_value == 0) {
+    // The owner may be asleep for longer than the first update takes //
+    link_->wake();
+  }
+
+  return return_value;
+}
+
+int PixyInterpreter::rcs_stop(uint8_t channel)
+{
+  if (channel >= PIXY_RCS_CHANNELS) {
     return PIXY_ERROR_INVALID_PARAMETER;
   }
-    
-  // Prevent other thread from accessing 'blocks_' while we're using it. //
 
-  blocks_access_mutex_.lock();
+  servos_.stop(channel);
 
-  number_of_blocks_to_copy = (max_blocks >= blocks_.size() ? blocks_.size() : max_blocks);
-  
-  // Copy blocks //
-  
-  for (index = 0; index != number_of_blocks_to_copy; ++index) {
-    memcpy(&blocks[index], &blocks_[index], sizeof(Block));
+  return 0;
+}
+
+int PixyInterpreter::rcs_set_stream_rate(uint16_t rate)
+{
+  if (rate < 1 || rate > 300) {
+    return PIXY_ERROR_INVALID_PARAMETER;
   }
 
-  blocks_are_new_ = false;
-  blocks_access_mutex_.unlock();
+  servos_.set_rate(rate);
 
-  return number_of_blocks_to_copy;
+  return 0;
 }
 
-int PixyInterpreter::send_command(const char * name, ...)
+void PixyInterpreter::stream_servos()
 {
-  va_list arguments;
-  int     return_value;
+  uint16_t positions[PIXY_RCS_CHANNELS];
+  uint32_t frequency;
+  uint32_t changed;
+  int      channel;
+
+  // Servos take one position per PWM period //
+  if (!settings_.get(PIXY_SETTING_RCS_FREQUENCY, &frequency)) {
+    frequency = PIXY_RCS_DEFAULT_FREQUENCY;
+  }
 
-  va_start(arguments, name);
-  return_value = send_command(name, arguments);
-  va_end(arguments);
+  changed = servos_.update(host_time(), frequency, positions);
 
-  return return_value;
+  // Sent by the next flush_settings(), like a coalesced setter //
+  for (channel = 0; channel != PIXY_RCS_CHANNELS; ++channel) {
+    if (changed & (1u << channel)) {
+      queue_setting((PixySetting) (PIXY_SETTING_RCS_POSITION_0 + channel), positions[channel]);
+    }
+  }
 }
 
-int PixyInterpreter::send_command(const char * name, va_list args)
+uint32_t PixyInterpreter::wait_limit(uint32_t timeout_ms)
 {
-  ChirpProc procedure_id;
-  int       return_value;
-  va_list   arguments;
+  uint32_t servo_ms;
 
-  va_copy(arguments, args);
+  servo_ms = servos_.next_update(host_time());
 
-  // Mutual exclusion for receiver_ object (Lock) //
-  chirp_access_mutex_.lock();
+  return servo_ms < timeout_ms ? servo_ms : timeout_ms;
+}
 
-  // Request chirp procedure id for 'name'. //
-  procedure_id = receiver_->getProc(name);
+int PixyInterpreter::flush_settings()
+{
+  uint32_t pending;
+  int      setting;
+  int      sent;
+
+  // A value posted while we send is sent again next time, //
+  // never lost.                                           //
+  pending = pending_settings_.exchange(0);
+  sent    = 0;
+
+  // No longer pending but not applied yet either: the cache must //
+  // miss until they are                                          //
+  for (setting = 0; setting != PIXY_SETTING_COUNT; ++setting) {
+    if (pending & (1u << setting)) {
+      cache_.invalidate((PixySetting) setting);
+    }
+  }
 
-  // Was there an error requesting procedure id? //
-  if (procedure_id < 0) {
-    // Request error //
-    va_end(arguments);
+  for (setting = 0; pending != 0; ++setting, pending >>= 1) {
+    if (pending & 1) {
+      apply_setting((PixySetting) setting, pending_values_[setting].load());
+      sent++;
+    }
+  }
 
-    // Mutual exclusion for receiver_ object (Unlock) //
-    chirp_access_mutex_.unlock();
+  return sent;
+}
 
-    return PIXY_ERROR_INVALID_COMMAND;
+int PixyInterpreter::apply_setting(PixySetting setting, uint32_t value)
+{
+  int return_value;
+  int response;
+
+  if (PixySettings::channel(setting) >= 0) {
+    // RC-servo positions are per channel //
+    return_value = execute_command(PixySettings::procedure(setting),
+                                   UINT8(PixySettings::channel(setting)),
+                                   PixySettings::type(setting), value,
+                                   END_OUT_ARGS, &response, END_IN_ARGS);
+  } else {
+    return_value = execute_command(PixySettings::procedure(setting),
+                                   PixySettings::type(setting), value,
+                                   END_OUT_ARGS, &response, END_IN_ARGS);
   }
 
-  // Execute chirp synchronous remote procedure call //
-  return_value = receiver_->call(SYNC, procedure_id, arguments); 
-  va_end(arguments);
+  if (return_value < 0) {
+    return return_value;
+  }
 
-  // Mutual exclusion for receiver_ object (Unlock) //
-  chirp_access_mutex_.unlock();
+  if (response >= 0) {
+    record_setting(setting, value);
+  }
 
-  return return_value;
+  return response;
 }
 
-void PixyInterpreter::interpreter_thread()
+void PixyInterpreter::record_setting(PixySetting setting, uint32_t value)
 {
-  thread_dead_ = false;
-  // Read from Pixy USB connection using the Chirp //
-  // protocol until we're told to stop.            //
-  while(!thread_die_) {
-    // Mutual exclusion for receiver_ object (Lock) //
-    chirp_access_mutex_.lock();
+  settings_.set(setting, value);
+  cache_store(setting, value);
+}
 
-    receiver_->service(false);
+void PixyInterpreter::set_caching(bool enable)
+{
+  caching_ = enable;
+  cache_.clear();
 
-    // Mutual exclusion for receiver_ object (Unlock) //
-    chirp_access_mutex_.unlock();
-    usleep(15000); // wait for 15ms, ie give time for 
+  if (enable && accepting_commands_) {
+    fill_cache();
   }
+}
 
-  thread_dead_ = true;
+bool PixyInterpreter::cache_lookup(PixySetting setting, uint32_t * value)
+{
+  // A coalesced setting may not have reached Pixy yet, nor //
+  // have turned an automatic mode on                       //
+  if (!caching_ || pending_settings_.load() != 0 || !cache_settled(setting)) {
+    return false;
+  }
+
+  return cache_.get(setting, value);
+}
+
+bool PixyInterpreter::cache_settled(PixySetting setting)
+{
+  uint32_t automatic;
+
+  // Pixy keeps changing these while the automatic mode is on //
+  if (setting == PIXY_SETTING_WHITE_BALANCE_VALUE) {
+    return cache_.get(PIXY_SETTING_AUTO_WHITE_BALANCE, &automatic) && automatic == 0;
+  }
+
+  if (setting == PIXY_SETTING_EXPOSURE_COMPENSATION) {
+    return cache_.get(PIXY_SETTING_AUTO_EXPOSURE_COMPENSATION, &automatic) && automatic == 0;
+  }
+
+  return true;
+}
+
+void PixyInterpreter::cache_store(PixySetting setting, uint32_t value)
+{
+  if (caching_ && cache_settled(setting)) {
+    cache_.set(setting, value);
+  }
 }
 
+void PixyInterpreter::fill_cache()
+{
+  const char * getter;
+  int          setting;
+  int          return_value;
+  uint32_t     response;
+
+  // In enum order, so the automatic modes are known before //
+  // the values they govern                                  //
+  for (setting = 0; setting != PIXY_SETTING_COUNT; ++setting) {
+    getter = PixySettings::getter((PixySetting) setting);
+
+    if (getter == NULL) {
+      continue;
+    }
+
+    if (PixySettings::channel((PixySetting) setting) >= 0) {
+      return_value = send_command(getter, UINT8(PixySettings::channel((PixySetting) setting)),
+                                  END_OUT_ARGS, &response, END_IN_ARGS);
+    } else {
+      return_value = send_command(getter, END_OUT_ARGS, &response, END_IN_ARGS);
+    }
+
+    if (return_value >= 0 && (int32_t) response >= 0) {
+      cache_store((PixySetting) setting, response);
+    }
+  }
+}
 
 void PixyInterpreter::interpret_data(const void * chirp_data[])
 {
@@ -225,7 +1396,9 @@ void PixyInterpreter::interpret_CCB1(const void * CCB1_data[])
 {
   uint32_t       number_of_blobs;
   const BlobA *  blobs;
-  uint32_t       index;
+  uint64_t       arrival;
+
+  arrival = host_time();
   
   // Add blocks with normal signatures //
   
@@ -233,13 +1406,11 @@ void PixyInterpreter::interpret_CCB1(const void * CCB1_data[])
   blobs           = static_cast<const BlobA *>(CCB1_data[4]);
   
   number_of_blobs /= sizeof(BlobA) / sizeof(uint16_t);
-  
-  // Wait for permission to use blocks_ vector //
-  blocks_access_mutex_.lock();
 
   add_normal_blocks(blobs, number_of_blobs);
-  blocks_are_new_ = true;
-  blocks_access_mutex_.unlock();
+
+  // CCB1 frames add to the blocks already buffered //
+  publish_blocks(number_of_blobs < PIXY_BLOCK_CAPACITY ? number_of_blobs : PIXY_BLOCK_CAPACITY, arrival);
 }
 
 
@@ -248,10 +1419,9 @@ void PixyInterpreter::interpret_CCB2(const void * CCB2_data[])
   uint32_t       number_of_blobs;
   const BlobA *  A_blobs;
   const BlobB *  B_blobs;
-  uint32_t       index;
+  uint64_t       arrival;
 
-  // Wait for permission to use blocks_ vector //
-  blocks_access_mutex_.lock();
+  arrival = host_time();
 
   // The blocks container will only contain the newest //
   // blocks                                            //
@@ -273,8 +1443,90 @@ void PixyInterpreter::interpret_CCB2(const void * CCB2_data[])
   number_of_blobs /= sizeof(BlobA) / sizeof(uint16_t);
   
   add_normal_blocks(A_blobs, number_of_blobs);
-  blocks_are_new_ = true;
-  blocks_access_mutex_.unlock();
+
+  // Everything buffered came with this frame //
+  publish_blocks(blocks_.size(), arrival);
+}
+
+void PixyInterpreter::publish_blocks(uint16_t frame_count, uint64_t timestamp)
+{
+  if (in_frame_callback_) {
+    // Decoded by a command issued from the frame callback, which is //
+    // still reading the back buffer. Publish it once it returns.    //
+    deferred_sequence_    = ++frame_sequence_;
+    deferred_frame_count_ = frame_count;
+    deferred_timestamp_   = timestamp;
+    return;
+  }
+
+  fill_frame(++frame_sequence_, frame_count, timestamp);
+
+  if (dispatch_frames_ && frame_callback_) {
+    report_frame(frames_.back());
+  }
+
+  hand_off_frame();
+
+  // Newer frame that arrived while the callback ran //
+  if (deferred_sequence_) {
+    fill_frame(deferred_sequence_, deferred_frame_count_, deferred_timestamp_);
+    deferred_sequence_ = 0;
+    hand_off_frame();
+  }
+}
+
+void PixyInterpreter::fill_frame(uint32_t sequence, uint16_t frame_count, uint64_t timestamp)
+{
+  BlockFrame & frame = frames_.back();
+
+  frame.sequence    = sequence;
+  frame.timestamp   = timestamp;
+  frame.count       = blocks_.copy(frame.blocks);
+  frame.frame_count = frame_count;
+}
+
+void PixyInterpreter::report_frame(const BlockFrame & frame)
+{
+  FrameCallback callback;
+  PixyFrameView view;
+
+  // Copied, the callback is allowed to replace itself //
+  callback = frame_callback_;
+
+  view.sequence         = frame.sequence;
+  view.timestamp        = frame.timestamp;
+  view.number_of_blocks = frame.frame_count;
+  view.blocks           = frame.blocks + frame.count - frame.frame_count;
+
+  in_frame_callback_ = true;
+  callback(view);
+  in_frame_callback_ = false;
+}
+
+void PixyInterpreter::hand_off_frame()
+{
+  frames_.publish();
+
+  // Pairs with the fence in wait_for_blocks(): either the waiter sees //
+  // the new frame, or we see the waiter and wake it.                  //
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // Without sleepers, publishing stays free of locks //
+  if (frame_waiters_.load() > 0) {
+    // Taking the mutex orders this wake up after a waiter's check //
+    frame_wait_mutex_.lock();
+    frame_wait_mutex_.unlock();
+    frame_ready_.notify_all();
+  }
+
+#ifdef __LINUX__
+  int fd = frame_fd_;
+
+  // Counter write, never blocks //
+  if (fd >= 0) {
+    eventfd_write(fd, 1);
+  }
+#endif
 }
 
 void PixyInterpreter::add_normal_blocks(const BlobA * blocks, uint32_t count)
@@ -297,16 +1549,10 @@ void PixyInterpreter::add_normal_blocks(const BlobA * blocks, uint32_t count)
     // signature types. Setting to zero by default. //
     block.angle     = 0;
       
-    // Store new block in block buffer //
+    // Store new block in block buffer. If the buffer is full //
+    // the oldest received block is replaced.                 //
 
-    if (blocks_.size() == PIXY_BLOCK_CAPACITY) {
-      // Blocks buffer is full - replace oldest received block with newest block //
-      blocks_.erase(blocks_.begin());
-      blocks_.push_back(block);
-    } else {
-      // Add new block to blocks buffer //
-      blocks_.push_back(block);
-    }
+    blocks_.push(block);
   }
 }
 
@@ -327,23 +1573,50 @@ void PixyInterpreter::add_color_code_blocks(const BlobB * blocks, uint32_t count
     block.y         = blocks[index].m_top + block.height / 2;
     block.angle     = blocks[index].m_angle;
 
-    // Store new block in block buffer //
+    // Store new block in block buffer. If the buffer is full //
+    // the oldest received block is replaced.                 //
 
-    if (blocks_.size() == PIXY_BLOCK_CAPACITY) {
-      // Blocks buffer is full - replace oldest received block with newest block //
-      blocks_.erase(blocks_.begin());
-      blocks_.push_back(block);
-    } else {
-      // Add new block to blocks buffer //
-      blocks_.push_back(block);
+    blocks_.push(block);
+  }
+}
+
+int PixyInterpreter::wait_for_blocks(uint32_t timeout_ms)
+{
+  bool is_new;
+
+  if (inline_) {
+    util::timer elapsed;
+    uint32_t    waited;
+
+    // Nobody else services the link, do it here until a frame arrives //
+    while (!frames_.fresh()) {
+      waited = elapsed.elapsed();
+      if (waited >= timeout_ms) {
+        return 0;
+      }
+      service_link(timeout_ms - waited);
     }
+
+    return 1;
   }
+
+  std::unique_lock<std::mutex> lock(frame_wait_mutex_);
+
+  frame_waiters_++;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  is_new = frame_ready_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                 [this] { return frames_.fresh(); });
+
+  frame_waiters_--;
+
+  return is_new ? 1 : 0;
 }
 
 int PixyInterpreter::blocks_are_new()
 {
   usleep(100); // sleep a bit so client doesn't need to
-  if (blocks_are_new_) {
+  if (frames_.fresh()) {
     // Fresh blocks!! :D //
     return 1;
   } else {
@@ -17,20 +17,88 @@
 #define __PIXYINTERPRETER_HPP__
 
 #include <vector>
+#include <deque>
+#include <map>
+#include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include "pixytypes.h"
 #include "pixy.h"
 #include "usblink.h"
+#include "pixyemulator.hpp"
 #include "interpreter.hpp"
 #include "chirpreceiver.hpp"
+#include "pixysettings.hpp"
+#include "triplebuffer.hpp"
+#include "ringbuffer.hpp"
+#include "mpscqueue.hpp"
+#include "servostreamer.hpp"
+#include "pixyservice.hpp"
+#include "proccatalog.hpp"
 
-#define PIXY_BLOCK_CAPACITY         250
+#define PIXY_BLOCK_CAPACITY         PIXY_MAX_BLOCKS_PER_FRAME
+
+// How often a lost Pixy is looked for when hotplug events //
+// are not available (ms).                                  //
+#define PIXY_RECONNECT_INTERVAL     250
+
+// Longest the interpreter thread blocks waiting for USB data //
+// before it rechecks whether it has been asked to stop.      //
+#define PIXY_INTERPRETER_WAIT_TIMEOUT  100
+
+// Most commands from other threads sent to Pixy back to back //
+// before their responses are collected.                       //
+#define PIXY_COMMAND_PIPELINE       8
+
+// Number of PixyPriority classes //
+#define PIXY_PRIORITY_CLASSES       3
+
+// Blocks as published by the interpreter thread //
+struct BlockFrame
+{
+  BlockFrame() : sequence(0), timestamp(0), count(0), frame_count(0) {}
+
+  uint32_t sequence;     // Frame number, 0: no frame yet
+  uint64_t timestamp;    // Host arrival time (us)
+  uint16_t count;        // Blocks buffered, oldest first
+  uint16_t frame_count;  // Trailing blocks that came with this frame
+  Block    blocks[PIXY_BLOCK_CAPACITY];
+};
+
+// A command handed to the interpreter thread by another thread. It //
+// lives on the sender's stack until the interpreter completes it.  //
+struct PixyCommand
+{
+  PixyCommand() : name(0), priority(PIXY_PRIORITY_NORMAL), deadline(0), result(0),
+                  buffer(0), buffer_size(0), done(false), next(0) {}
+
+  const char *               name;
+  va_list                    arguments;
+  PixyPriority               priority;
+  uint64_t                   deadline;     // Host time (us) to be sent by, 0: none
+  int                        result;
+  uint8_t *                  buffer;       // Receive buffer traded for the response
+  uint32_t                   buffer_size;
+  bool                       done;         // Guarded by 'command_mutex_'
+  std::atomic<PixyCommand *> next;         // MpscQueue link
+
+  // Set for send_command_async(): runs instead of 'name' and the //
+  // command is heap allocated, nobody waits for it.              //
+  std::function<int ()>      work;
+  std::function<void (int)>  callback;
+};
 
 class PixyInterpreter : public Interpreter
 {
   public:
 
+    typedef std::function<void(const PixyFrameView &)> FrameCallback;
+    typedef std::function<int ()>                       AsyncCommand;
+    typedef std::function<void (int)>                   CommandCallback;
+
     PixyInterpreter();
     ~PixyInterpreter();
 
@@ -41,18 +109,84 @@ class PixyInterpreter : public Interpreter
               capture and store Pixy 'block' object data 
               which can be retreived using the getBlocks()
               method.
+       @param[in] threading  PIXY_THREAD_DEDICATED: a thread of its own.
+                             PIXY_THREAD_SHARED: serviced by the PixyService
+                             thread shared with other cameras.
+                             PIXY_THREAD_NONE: no thread, the application
+                             drives the connection with service().
+       @param[in] fast_open  Skip the USB reset on open, falling back to it
+                             if Pixy does not answer.
        @return   0    Success
        @return  -1    Error: Unable to open pixy USB device
 
     */
   
-    int init();
+    int init(PixyThreading threading = PIXY_THREAD_DEDICATED, bool fast_open = false);
+
+    /**
+      @brief  Like init(), but connects to an emulated Pixy on an
+              in-memory link instead of a camera. Lets the library
+              be exercised without hardware.
+      @param[in] frame_rate         Frames the emulator sends per second.
+      @param[in] normal_blocks      Blocks with normal signatures per frame.
+      @param[in] color_code_blocks  Blocks with color code signatures per frame.
+      @param[in] threading          As in init(). Emulated cameras never
+                                    share the service thread.
+      @return   0    Success
+    */
+    int init_emulated(uint32_t frame_rate, uint16_t normal_blocks, uint16_t color_code_blocks,
+                      PixyThreading threading = PIXY_THREAD_DEDICATED);
+
+    /**
+      @brief  The emulated Pixy, NULL unless opened with init_emulated().
+    */
+    PixyEmulator * emulator() { return emulator_; }
+
+    /**
+      @brief  Inline mode: does the work of the interpreter thread once.
+              Waits up to 'timeout_ms' for data from Pixy, then decodes
+              everything that has arrived (publishing frames and calling
+              the frame callback from the caller's thread).
+      @return  Non-negative            Number of chirps serviced
+      @return  PIXY_ERROR_INITIALIZED  An interpreter thread is running
+    */
+    int service(uint32_t timeout_ms);
+
+    /**
+      @brief  Inline mode: the file descriptors to poll for USB events.
+              When one is ready, call service(0).
+      @param[out] fds      Array to fill.
+      @param[in]  max_fds  Size of 'fds'.
+      @return  Non-negative            Number of descriptors libusb uses,
+                                       may be larger than 'max_fds'
+      @return  PIXY_ERROR_UNSUPPORTED  No pollable descriptors (Windows, emulator)
+    */
+    int get_pollfds(PixyPollfd * fds, int max_fds);
+
+    /**
+      @brief  Inline mode: longest time to poll before service() must
+              be called even if no descriptor became ready.
+      @return  1                       'timeout_ms' was set
+      @return  0                       No deadline pending
+      @return  PIXY_ERROR_UNSUPPORTED  Not a USB connection
+    */
+    int get_next_timeout(uint32_t * timeout_ms);
     
     /**
       @brief  Terminates the USB connection to Pixy and
-              the 'iterpreter' thread.
+              the 'iterpreter' thread. Transfers in progress are
+              cancelled, so it returns within a few milliseconds.
+              Commands still queued are abandoned and complete
+              with PIXY_ERROR_UNINITIALIZED. Coalesced settings
+              posted before the call are sent first, ones posted
+              while it runs are discarded.
+      @return  0                       Success
+      @return  PIXY_ERROR_IN_CALLBACK  Called from inside service_link(),
+                                       by a frame callback or async command:
+                                       the receiver is in use further up the
+                                       stack, and a thread can't join itself.
     */
-    void close();
+    int close();
 
    /**
      @brief      Get status of the block data received from Pixy. 
@@ -62,6 +196,14 @@ class PixyInterpreter : public Interpreter
    */
     int blocks_are_new();
 
+    /**
+      @brief      Sleeps until new block data is published, or 'timeout_ms' elapses.
+
+      @return  1  New Data: Pixy sent new data that has not been retrieve yet.
+      @return  0  Timeout: No new data arrived in time.
+    */
+    int wait_for_blocks(uint32_t timeout_ms);
+
     /**
       @brief      Copies up to 'max_blocks' number of Blocks to the address pointed
                   to by 'blocks'. 
@@ -79,11 +221,48 @@ class PixyInterpreter : public Interpreter
     */
     int get_blocks(int max_blocks, Block * blocks);
 
+    /**
+      @brief      Copies the latest frame received from Pixy to 'frame'.
+      @param[out] frame  Sequence number, arrival time, frames dropped since
+                         the previous read and the blocks of this frame only.
+      @return  1                             New frame
+      @return  0                             Frame was read before
+      @return  PIXY_ERROR_INVALID_PARAMETER  Invalid pararmeter specified
+    */
+    int get_frame(PixyFrame * frame);
+
+    /**
+      @brief      Registers 'callback' to be called from the interpreter
+                  thread for every frame it decodes, before the frame is
+                  handed to readers. The callback may send commands; frames
+                  that arrive while a command is in progress are published
+                  but not reported.
+      @param[in]  callback  Function to call, empty to unregister.
+    */
+    void on_frame(FrameCallback callback);
+
+    /**
+      @brief      Gets an eventfd that becomes readable when a frame is
+                  published. Created on first use, closed with the interpreter.
+      @return     Non-negative            The file descriptor
+      @return     PIXY_ERROR_UNSUPPORTED  eventfd is not available (not Linux)
+      @return     PIXY_ERROR_USB_IO       eventfd could not be created
+    */
+    int frame_fd();
+
     /**
       @brief         Sends a command to Pixy.
+
+                     The thread servicing the link owns the Chirp session.
+                     Other threads post the command to it and sleep until
+                     the response is back, so they never wait for the link
+                     to go quiet. Returned arrays stay valid until the
+                     calling thread sends its next command.
+
       @param[in]     name       Remote procedure call identifier string.
       @param[in,out] arguments  Argument list to function call.
-      @return        -1         Error
+      @return        -1                        Error
+      @return        PIXY_ERROR_UNINITIALIZED  Not connected, or closing
     */
     int send_command(const char * name, va_list arguments);
 
@@ -94,24 +273,207 @@ class PixyInterpreter : public Interpreter
     */
     int send_command(const char * name, ...);
 
+    /**
+      @brief         Sends a command to Pixy ahead of the queued commands of
+                     a lower priority. Plain send_command() takes the class
+                     of the procedure: servo positions go first, LED and
+                     version queries last.
+      @param[in]     deadline_ms  Time to get it sent, 0 for the default
+                                  of the class.
+      @return        PIXY_ERROR_TIMEOUT  The deadline passed before the
+                                         command was sent, it was dropped
+    */
+    int send_command(PixyPriority priority, uint32_t deadline_ms, const char * name, va_list arguments);
+
+    /**
+      @brief         Sets the deadline of commands of class 'priority' that
+                     do not set their own, 0 for none.
+      @return        0                             Success
+      @return        PIXY_ERROR_INVALID_PARAMETER  No such class
+    */
+    int set_command_deadline(PixyPriority priority, uint32_t deadline_ms);
+
+    /**
+      @brief         Runs 'command' on the thread servicing the link and
+                     returns without waiting for it. Commands run in the
+                     order they were posted, in inline mode from service().
+      @param[in]     command   Sends the actual command(s), returns the result.
+      @param[in]     callback  Called with that result from the same thread,
+                               may be empty.
+      @return        0                         Queued
+      @return        PIXY_ERROR_UNINITIALIZED  Not connected, or closing
+    */
+    int send_command_async(AsyncCommand command, CommandCallback callback);
+
     /**
       @brief         Gets the device address of the Pixy this interpreter is associated with.
       @return        Non-negative         The device address.
       @return        Negative             Error
     */
-    int device_address() const { return link_.device_address(); }
+    int device_address() const { return usb_link_.device_address(); }
+
+    /**
+      @brief         Sets how many bulk-IN transfers are kept queued on the Pixy endpoint.
+      @param[in]     transfers  Queue depth, 0 to receive synchronously.
+      @return        0          Success
+      @return        Negative   USB Error
+    */
+    int set_receive_queue(uint8_t transfers);
+
+    /**
+      @brief         Has Pixy tag each response with the procedure it answers,
+                     so pipelined calls are matched by tag instead of in call
+                     order. Off by default: only for firmware known to echo
+                     the tags. Procedures are enumerated again to hand them out.
+      @return        0                         Success
+      @return        PIXY_ERROR_UNINITIALIZED  Not connected
+    */
+    int set_response_tags(bool enable);
+
+    /**
+      @brief         Coalescing: setters covered by PixySettings only record
+                     their value and return. The thread servicing the link
+                     then sends the newest value of each setting (per servo
+                     channel for positions), dropping the ones overtaken
+                     meanwhile. Settings go out in PixySetting order, before
+                     the commands posted at the same time.
+    */
+    void set_coalescing(bool enable) { coalescing_ = enable; }
+    bool coalescing() const { return coalescing_; }
+
+    /**
+      @brief         Coalescing: makes 'value' the next value to send for 'setting'.
+      @return        0                         Recorded
+      @return        PIXY_ERROR_UNINITIALIZED  Not connected, or closing
+    */
+    int post_setting(PixySetting setting, uint32_t value);
+
+    /**
+      @brief         Streams 'waypoints' to servo 'channel' from the thread
+                     servicing the link (from service() in inline mode),
+                     replacing the trajectory in progress. Positions go out
+                     as coalesced settings at the stream rate.
+      @return        0                             Success
+      @return        PIXY_ERROR_INVALID_PARAMETER  Bad channel or waypoints
+      @return        PIXY_ERROR_UNINITIALIZED      Not connected, or closing
+    */
+    int rcs_stream(uint8_t channel, const PixyServoWaypoint * waypoints, int count);
+
+    /**
+      @brief         Ends the trajectory of servo 'channel' where it is.
+    */
+    int rcs_stop(uint8_t channel);
+
+    /**
+      @brief         Sets the servo stream rate (Hz), never above the
+                     recorded PWM frequency.
+      @return        0                             Success
+      @return        PIXY_ERROR_INVALID_PARAMETER  Out of range
+    */
+    int rcs_set_stream_rate(uint16_t rate);
+
+    /**
+      @brief         Last known camera settings. Setters record values here
+                     and they are re-applied when Pixy is reattached.
+    */
+    PixySettings & settings() { return settings_; }
+
+    /**
+      @brief         Settings cache: getters covered by PixySettings answer
+                     from the values last read from or written to Pixy
+                     instead of asking it. Enabling reads every setting
+                     once; the cache is refilled when Pixy is reattached.
+                     White balance and exposure are only cached while their
+                     automatic mode is known to be off.
+    */
+    void set_caching(bool enable);
+
+    /**
+      @brief         Settings cache: looks up 'setting'. Misses while a
+                     coalesced setting waits to be sent.
+      @return        true   'value' is Pixy's current value
+      @return        false  Ask Pixy
+    */
+    bool cache_lookup(PixySetting setting, uint32_t * value);
+
+    /**
+      @brief         Settings cache: remembers 'value' just read from Pixy.
+    */
+    void cache_store(PixySetting setting, uint32_t value);
+
+    /**
+      @brief         Records 'value' just applied to Pixy, to be restored
+                     on reattach, and writes it through to the cache.
+    */
+    void record_setting(PixySetting setting, uint32_t value);
 
   private:
+
+    friend class PixyService;
     
     ChirpReceiver *    receiver_;
-    USBLink            link_;
+    USBLink            usb_link_;
+    PixyEmulator *     emulator_;
+    Link *             link_;
     std::thread		   thread_;
-    bool               thread_die_;
-    bool               thread_dead_;
-    std::vector<Block> blocks_;
-    std::mutex         blocks_access_mutex_;
-    std::mutex         chirp_access_mutex_;
-    bool               blocks_are_new_;
+    std::atomic<bool>  thread_die_;
+    std::atomic<bool>  thread_dead_;
+    std::mutex         stop_mutex_;
+    std::condition_variable stop_requested_;
+    RingBuffer<Block, PIXY_BLOCK_CAPACITY> blocks_;
+    std::recursive_mutex chirp_access_mutex_;
+    TripleBuffer<BlockFrame> frames_;
+    std::mutex         frame_read_mutex_;
+    uint32_t           frame_sequence_;
+    uint32_t           last_read_sequence_;
+    std::mutex         frame_wait_mutex_;
+    std::condition_variable frame_ready_;
+    std::atomic<uint32_t> frame_waiters_;
+
+    std::atomic<int>   frame_fd_;
+    bool               inline_;
+    bool               shared_;
+
+    // Frame callback state, guarded by 'chirp_access_mutex_' //
+    FrameCallback      frame_callback_;
+    bool               dispatch_frames_;
+    bool               in_frame_callback_;
+    uint32_t           deferred_sequence_;
+    uint16_t           deferred_frame_count_;
+    uint64_t           deferred_timestamp_;
+    std::map<std::string, ChirpProc> procedures_;
+
+    // Catalog of the connected firmware, guarded by 'chirp_access_mutex_' //
+    ProcCatalog        catalog_;
+    uint16_t           catalog_version_[3];
+    bool               cataloging_;
+
+    PixySettings       settings_;
+
+    // Commands posted to the owner (the thread servicing the link) //
+    MpscQueue<PixyCommand> commands_;
+    std::mutex         command_mutex_;
+    std::condition_variable command_done_;
+    std::atomic<bool>  accepting_commands_;
+    std::atomic<int>   command_callers_;
+    std::atomic<std::thread::id> owner_;
+    std::atomic<std::thread::id> servicing_;  // Inside service_link(), see close()
+
+    // Posted commands by priority class, only touched by the owner //
+    std::deque<PixyCommand *> ready_[PIXY_PRIORITY_CLASSES];
+    std::atomic<uint32_t> class_deadlines_[PIXY_PRIORITY_CLASSES];
+
+    // Coalesced setters: a bit per PixySetting waiting to be sent //
+    std::atomic<bool>  coalescing_;
+    std::atomic<uint32_t> pending_settings_;
+    std::atomic<uint32_t> pending_values_[PIXY_SETTING_COUNT];
+
+    // Settings cache, 'cache_' is empty while 'caching_' is off //
+    std::atomic<bool>  caching_;
+    PixySettings       cache_;
+
+    // Servo trajectories, sampled by the owner //
+    ServoStreamer      servos_;
 
     /**
       @brief  Interpreter thread entry point.
@@ -119,11 +481,164 @@ class PixyInterpreter : public Interpreter
               Performs the following operations:
 
               1. Connect to Pixy.
-              2. Interpretes Pixy messages and saves
+              2. Sleeps on libusb events until Pixy sends data.
+              3. Interpretes all pending Pixy messages and saves
                  pixy 'block' objects.
     */
     void interpreter_thread(); 
 
+    /**
+      @brief  Sleeps for 'wait_ms', returning early once close() is called.
+    */
+    void idle(uint32_t wait_ms);
+
+    /**
+      @brief  Completes every command posted but not run with
+              PIXY_ERROR_UNINITIALIZED. Called by close() only.
+      @return Number of commands abandoned
+    */
+    int abandon_commands();
+
+    /**
+      @brief  Starts a Chirp session on 'link' and spawns the
+              interpreter thread.
+      @return   0    Success
+    */
+    int start(Link * link, PixyThreading threading);
+
+    /**
+      @brief  One pass of the interpreter loop: reconnects a lost Pixy,
+              or waits up to 'timeout_ms' for data and services it.
+      @return Number of chirps serviced
+    */
+    int service_link(uint32_t timeout_ms);
+
+    /**
+      @brief  Calls procedure 'name' on Pixy from the owner thread.
+    */
+    int execute_command(const char * name, va_list arguments);
+    int execute_command(const char * name, ...);
+
+    /**
+      @brief  Hands a command to the owner thread and waits for the result.
+    */
+    int post_command(PixyPriority priority, uint64_t deadline, const char * name, va_list arguments);
+
+    /**
+      @brief  Priority class of procedure 'name'.
+    */
+    static PixyPriority procedure_priority(const char * name);
+
+    /**
+      @brief  Owner thread: executes the posted commands, highest priority
+              class first, and wakes their senders.
+      @return Number of commands executed
+    */
+    int run_commands();
+
+    /**
+      @brief  Owner thread: executes 'count' posted calls, pipelined if the
+              link can take responses while calls are still being sent.
+              Calls past their deadline fail with PIXY_ERROR_TIMEOUT.
+    */
+    void execute_batch(PixyCommand * batch[], int count);
+
+    /**
+      @brief  Whether the session runs over USB (as opposed to
+              an emulator).
+    */
+    bool using_usb() const { return link_ == &usb_link_; }
+
+    /**
+      @brief  Looks up the Chirp procedure id for 'name'.
+
+              Procedure ids are only valid for the current connection.
+              The first lookup of a name enumerates it on Pixy, later
+              lookups are served from the 'procedures_' cache. Caller
+              must hold 'chirp_access_mutex_'.
+
+      @param[in] name  Remote procedure call identifier string.
+      @return    Non-negative  Procedure id
+      @return    Negative      Procedure not found
+    */
+    ChirpProc get_procedure(const char * name);
+
+    /**
+      @brief  Fills 'procedures_' from the catalog of Pixy's firmware
+              version, starting an empty one if there is none yet.
+              get_procedure() then adds each newly enumerated procedure
+              and saves the catalog. Does nothing unless a catalog
+              directory is set.
+    */
+    void load_procedures();
+
+    /**
+      @brief  Checks whether the Chirp connection to Pixy is still up.
+    */
+    bool connected();
+
+    /**
+      @brief  Reattaches to Pixy after the connection was lost.
+
+              Reclaims the camera on the same USB port, starts a new Chirp
+              session and re-applies the recorded settings. If the camera
+              is not back yet, waits up to 'wait_ms' for a hotplug
+              arrival before returning.
+    */
+    void reconnect(uint32_t wait_ms);
+
+    /**
+      @brief  Starts a Chirp session on 'link_' in a new 'receiver_'.
+    */
+    void create_receiver();
+
+    /**
+      @brief  Sends every recorded setting to Pixy.
+    */
+    void restore_settings();
+
+    /**
+      @brief  Owner thread: sends the newest value of every coalesced setting.
+      @return Number of settings sent
+    */
+    int flush_settings();
+
+    /**
+      @brief  Makes 'value' the next value flush_settings() sends for 'setting'.
+    */
+    void queue_setting(PixySetting setting, uint32_t value);
+
+    /**
+      @brief  Owner thread: queues the servo positions due from the
+              trajectories in progress.
+    */
+    void stream_servos();
+
+    /**
+      @brief  Shortens 'timeout_ms' so the owner is back in time for
+              the next servo update.
+    */
+    uint32_t wait_limit(uint32_t timeout_ms);
+
+    /**
+      @brief  Owner thread: sends 'value' for 'setting' to Pixy and
+              records it on success.
+      @return Pixy's response, or a negative error
+    */
+    int apply_setting(PixySetting setting, uint32_t value);
+
+    /**
+      @brief  Reads every setting Pixy has a getter for into the cache.
+    */
+    void fill_cache();
+
+    /**
+      @brief  Whether Pixy leaves 'setting' alone, so a cached value
+              stays valid: white balance and exposure only while their
+              automatic mode is known to be off.
+    */
+    bool cache_settled(PixySetting setting);
+
     /**
       @brief Interprets data sent from Pixy over the Chirp protocol.
 
@@ -162,6 +677,34 @@ class PixyInterpreter : public Interpreter
       @param[in] count   Size of the 'blocks' array.
     */
     void add_color_code_blocks(const BlobB * blocks, uint32_t count);
+
+    /**
+      @brief Publishes a copy of 'blocks_' for get_blocks() and get_frame().
+
+             'blocks_' is only touched by the interpreter thread. Readers
+             get their own copy through 'frames_', so publishing never
+             waits for them and they never see a half decoded frame.
+
+      @param[in] frame_count  Number of blocks at the end of 'blocks_'
+                              that came with this frame.
+      @param[in] timestamp    Host arrival time of the frame (us).
+    */
+    void publish_blocks(uint16_t frame_count, uint64_t timestamp);
+
+    /**
+      @brief Copies 'blocks_' to the back buffer of 'frames_'.
+    */
+    void fill_frame(uint32_t sequence, uint16_t frame_count, uint64_t timestamp);
+
+    /**
+      @brief Passes the blocks of 'frame' to the frame callback.
+    */
+    void report_frame(const BlockFrame & frame);
+
+    /**
+      @brief Publishes the back buffer of 'frames_' and wakes waiting readers.
+    */
+    void hand_off_frame();
 };
 
 #endif
@@ -0,0 +1,126 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#include <algorithm>
+#include "pixyservice.hpp"
+#include "pixyinterpreter.hpp"
+#include "usblink.h"
+
+std::mutex                     PixyService::mutex_;
+std::condition_variable        PixyService::idle_;
+std::vector<PixyInterpreter *> PixyService::interpreters_;
+PixyInterpreter *              PixyService::busy_ = NULL;
+std::thread                    PixyService::thread_;
+std::atomic<uint32_t>          PixyService::generation_(0);
+
+void PixyService::attach(PixyInterpreter * interpreter)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  interpreters_.push_back(interpreter);
+
+  if (!thread_.joinable()) {
+    thread_ = std::thread(&PixyService::service_thread, ++generation_);
+  }
+}
+
+void PixyService::detach(PixyInterpreter * interpreter)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::thread                  stopped;
+
+  interpreters_.erase(std::remove(interpreters_.begin(), interpreters_.end(), interpreter),
+                      interpreters_.end());
+
+  if (std::this_thread::get_id() == thread_.get_id()) {
+    // A callback of another camera closing this one: 'interpreter' //
+    // isn't being serviced, but the thread can't join itself.      //
+    // Stopped, it leaves its loop once back from the callback.     //
+    if (interpreters_.empty()) {
+      ++generation_;
+      thread_.detach();
+    }
+    return;
+  }
+
+  // Only this camera's servicing is waited for //
+  idle_.wait(lock, [interpreter] { return busy_ != interpreter; });
+
+  if (interpreters_.empty() && thread_.joinable()) {
+    ++generation_;
+    stopped.swap(thread_);
+  }
+
+  lock.unlock();
+
+  // Joined without the mutex, the thread needs it to notice //
+  if (stopped.joinable()) {
+    stopped.join();
+  }
+}
+
+void PixyService::service_thread(uint32_t generation)
+{
+  std::vector<PixyInterpreter *> serviced;
+  PixyInterpreter *              interpreter;
+  size_t                         index;
+  uint32_t                       timeout_ms;
+
+  while (generation_ == generation) {
+    // Back in time for the earliest servo update //
+    mutex_.lock();
+
+    timeout_ms = PIXY_SERVICE_WAIT_TIMEOUT;
+    for (index = 0; index != interpreters_.size(); ++index) {
+      timeout_ms = interpreters_[index]->wait_limit(timeout_ms);
+    }
+
+    // Serviced without the mutex, so a slow camera (reconnecting, or //
+    // waiting out a command timeout) holds up neither the others nor  //
+    // attach() and detach().                                          //
+    serviced = interpreters_;
+
+    mutex_.unlock();
+
+    // Completes the transfers of every camera at once //
+    USBLink::handleEvents(timeout_ms);
+
+    for (index = 0; index != serviced.size(); ++index) {
+      interpreter = serviced[index];
+
+      mutex_.lock();
+
+      // Skip cameras detached meanwhile, and once stopped leave //
+      // the rest to the thread that may have replaced this one. //
+      if (generation_ != generation ||
+          std::find(interpreters_.begin(), interpreters_.end(), interpreter) == interpreters_.end()) {
+        mutex_.unlock();
+        continue;
+      }
+
+      busy_ = interpreter;
+      mutex_.unlock();
+
+      interpreter->service_link(0);
+
+      mutex_.lock();
+      if (busy_ == interpreter) {
+        busy_ = NULL;
+      }
+      mutex_.unlock();
+      idle_.notify_all();
+    }
+  }
+}
@@ -0,0 +1,74 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#ifndef __PIXYSERVICE_HPP__
+#define __PIXYSERVICE_HPP__
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Longest the service thread blocks on USB events before it //
+// rechecks lost cameras and whether it has been asked to stop. //
+#define PIXY_SERVICE_WAIT_TIMEOUT   100
+
+class PixyInterpreter;
+
+/**
+  @brief  One thread servicing every camera opened with PIXY_THREAD_SHARED.
+
+          All USB links share a libusb context, so a single wait on its
+          events completes the queued transfers of every camera. The
+          thread then lets each attached interpreter decode what arrived.
+          The thread starts with the first camera and stops with the last.
+*/
+class PixyService
+{
+  public:
+
+    /**
+      @brief  Starts servicing 'interpreter'.
+    */
+    static void attach(PixyInterpreter * interpreter);
+
+    /**
+      @brief  Stops servicing 'interpreter'. Once this returns the
+              service thread no longer touches it: waits for it to finish
+              with this camera, never for the others. Never called by
+              the service thread for the camera it is servicing, close()
+              refuses that; a callback of one camera may close another.
+    */
+    static void detach(PixyInterpreter * interpreter);
+
+  private:
+
+    static std::mutex                     mutex_;
+    static std::condition_variable        idle_;
+    static std::vector<PixyInterpreter *> interpreters_;
+    static PixyInterpreter *              busy_;        // Being serviced, guarded by 'mutex_'
+    static std::thread                    thread_;
+    static std::atomic<uint32_t>          generation_;  // Bumped to stop the service thread
+
+    /**
+      @brief  Service thread entry point. Runs until 'generation_'
+              moves on from 'generation'.
+    */
+    static void service_thread(uint32_t generation);
+};
+
+#endif
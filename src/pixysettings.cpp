@@ -0,0 +1,109 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#include "pixysettings.hpp"
+#include "chirp.hpp"
+
+struct PixySettingProcedure
+{
+  const char * name;
+  uint8_t      type;
+  int          channel;
+  const char * getter;
+};
+
+// Indexed by PixySetting, in the order settings are restored //
+static const PixySettingProcedure PIXY_SETTING_PROCEDURES[PIXY_SETTING_COUNT] = {
+  { "cam_setAWB",        CRP_INT8,  -1, "cam_getAWB"        },
+  { "cam_setWBV",        CRP_INT32, -1, "cam_getWBV"        },
+  { "cam_setAEC",        CRP_INT8,  -1, "cam_getAEC"        },
+  { "cam_setECV",        CRP_INT32, -1, "cam_getECV"        },
+  { "cam_setBrightness", CRP_INT8,  -1, "cam_getBrightness" },
+  { "led_setMaxCurrent", CRP_INT32, -1, "led_getMaxCurrent" },
+  { "led_set",           CRP_INT32, -1, NULL                },
+  { "rcs_setFreq",       CRP_INT16, -1, NULL                },
+  { "rcs_setPos",        CRP_INT16,  0, "rcs_getPos"        },
+  { "rcs_setPos",        CRP_INT16,  1, "rcs_getPos"        },
+};
+
+PixySettings::PixySettings()
+{
+  clear();
+}
+
+void PixySettings::set(PixySetting setting, uint32_t value)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  values_[setting] = value;
+  valid_[setting]  = true;
+
+  // Pixy picks its own white balance and exposure while the //
+  // automatic modes are on                                  //
+  if (setting == PIXY_SETTING_AUTO_WHITE_BALANCE && value) {
+    valid_[PIXY_SETTING_WHITE_BALANCE_VALUE] = false;
+  } else if (setting == PIXY_SETTING_AUTO_EXPOSURE_COMPENSATION && value) {
+    valid_[PIXY_SETTING_EXPOSURE_COMPENSATION] = false;
+  }
+}
+
+bool PixySettings::get(PixySetting setting, uint32_t * value)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!valid_[setting]) {
+    return false;
+  }
+
+  *value = values_[setting];
+  return true;
+}
+
+void PixySettings::invalidate(PixySetting setting)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  valid_[setting] = false;
+}
+
+void PixySettings::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (int index = 0; index != PIXY_SETTING_COUNT; ++index) {
+    valid_[index]  = false;
+    values_[index] = 0;
+  }
+}
+
+const char * PixySettings::procedure(PixySetting setting)
+{
+  return PIXY_SETTING_PROCEDURES[setting].name;
+}
+
+uint8_t PixySettings::type(PixySetting setting)
+{
+  return PIXY_SETTING_PROCEDURES[setting].type;
+}
+
+int PixySettings::channel(PixySetting setting)
+{
+  return PIXY_SETTING_PROCEDURES[setting].channel;
+}
+
+const char * PixySettings::getter(PixySetting setting)
+{
+  return PIXY_SETTING_PROCEDURES[setting].getter;
+}
@@ -0,0 +1,93 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#ifndef __PIXYSETTINGS_HPP__
+#define __PIXYSETTINGS_HPP__
+
+#include <stdint.h>
+#include <mutex>
+
+// Camera settings the library remembers per Pixy //
+enum PixySetting
+{
+  PIXY_SETTING_AUTO_WHITE_BALANCE,
+  PIXY_SETTING_WHITE_BALANCE_VALUE,
+  PIXY_SETTING_AUTO_EXPOSURE_COMPENSATION,
+  PIXY_SETTING_EXPOSURE_COMPENSATION,
+  PIXY_SETTING_BRIGHTNESS,
+  PIXY_SETTING_LED_MAX_CURRENT,
+  PIXY_SETTING_LED_RGB,
+  PIXY_SETTING_RCS_FREQUENCY,
+  PIXY_SETTING_RCS_POSITION_0,
+  PIXY_SETTING_RCS_POSITION_1,
+  PIXY_SETTING_COUNT
+};
+
+class PixySettings
+{
+  public:
+
+    PixySettings();
+
+    /**
+      @brief      Records the last value successfully applied to Pixy.
+                  Turning automatic white balance or exposure on forgets
+                  the manual value.
+      @param[in]  setting  Setting identifier.
+      @param[in]  value    Value, packed the way the setter procedure expects it.
+    */
+    void set(PixySetting setting, uint32_t value);
+
+    /**
+      @brief      Retrieves a recorded value.
+      @param[in]  setting  Setting identifier.
+      @param[out] value    Recorded value.
+      @return     true     A value is recorded.
+      @return     false    Nothing recorded for 'setting'.
+    */
+    bool get(PixySetting setting, uint32_t * value);
+
+    void invalidate(PixySetting setting);
+    void clear();
+
+    /**
+      @brief      Name of the Chirp procedure that applies 'setting'.
+    */
+    static const char * procedure(PixySetting setting);
+
+    /**
+      @brief      Chirp type (CRP_INT8, ...) of the procedure's value argument.
+    */
+    static uint8_t type(PixySetting setting);
+
+    /**
+      @brief      Servo channel of an RC-servo position setting, -1 otherwise.
+    */
+    static int channel(PixySetting setting);
+
+    /**
+      @brief      Name of the Chirp procedure that reads 'setting' back,
+                  NULL if Pixy has none.
+    */
+    static const char * getter(PixySetting setting);
+
+  private:
+
+    std::mutex mutex_;
+    bool       valid_[PIXY_SETTING_COUNT];
+    uint32_t   values_[PIXY_SETTING_COUNT];
+};
+
+#endif
@@ -0,0 +1,300 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "proccatalog.hpp"
+#include "pixydefs.h"
+#include "debuglog.h"
+
+#define PIXY_CATALOG_HEADER  "pixy-procs 1"
+
+std::mutex  ProcCatalog::mutex_;
+std::string ProcCatalog::directory_;
+
+// Names and info strings may hold anything but the field and line separators //
+static std::string escape(const std::string & text)
+{
+  std::string escaped;
+  size_t      index;
+
+  for (index = 0; index != text.size(); ++index) {
+    switch (text[index]) {
+      case '\\': escaped += "\\\\"; break;
+      case '\t': escaped += "\\t";  break;
+      case '\n': escaped += "\\n";  break;
+      case '\r': escaped += "\\r";  break;
+      default:   escaped += text[index];
+    }
+  }
+
+  return escaped;
+}
+
+static std::string unescape(const std::string & text)
+{
+  std::string unescaped;
+  size_t      index;
+
+  for (index = 0; index != text.size(); ++index) {
+    if (text[index] != '\\' || index + 1 == text.size()) {
+      unescaped += text[index];
+      continue;
+    }
+
+    switch (text[++index]) {
+      case 't': unescaped += '\t'; break;
+      case 'n': unescaped += '\n'; break;
+      case 'r': unescaped += '\r'; break;
+      default:  unescaped += text[index];
+    }
+  }
+
+  return unescaped;
+}
+
+// Argument types are single byte type codes, not text //
+static std::string to_hex(const std::string & bytes)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string       hex;
+  size_t            index;
+
+  for (index = 0; index != bytes.size(); ++index) {
+    hex += digits[(uint8_t) bytes[index] >> 4];
+    hex += digits[(uint8_t) bytes[index] & 0x0f];
+  }
+
+  return hex;
+}
+
+static bool from_hex(const std::string & hex, std::string * bytes)
+{
+  size_t index;
+
+  if (hex.size() % 2 != 0 ||
+      hex.find_first_not_of("0123456789abcdef") != std::string::npos) {
+    return false;
+  }
+
+  bytes->clear();
+
+  for (index = 0; index != hex.size(); index += 2) {
+    *bytes += (char) strtol(hex.substr(index, 2).c_str(), NULL, 16);
+  }
+
+  return true;
+}
+
+// Digits only, a damaged file must not pass for a shorter number //
+static bool parse_number(const std::string & text, unsigned long limit, unsigned long * number)
+{
+  if (text.empty() || text.size() > 10 ||
+      text.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+
+  *number = strtoul(text.c_str(), NULL, 10);
+
+  return *number <= limit;
+}
+
+void ProcCatalog::set_directory(const char * directory)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  directory_ = directory ? directory : "";
+}
+
+bool ProcCatalog::enabled()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return !directory_.empty();
+}
+
+std::string ProcCatalog::path(uint16_t major, uint16_t minor, uint16_t build)
+{
+  char name[64];
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (directory_.empty()) {
+    return "";
+  }
+
+  snprintf(name, sizeof(name), "/pixy-procs-%u.%u.%u", major, minor, build);
+
+  return directory_ + name;
+}
+
+bool ProcCatalog::load(uint16_t major, uint16_t minor, uint16_t build)
+{
+  std::string      file_name;
+  std::string      contents;
+  std::string      line;
+  ProcCatalogEntry entry;
+  FILE *           file;
+  char             chunk[4096];
+  size_t           length;
+  size_t           start;
+  size_t           end;
+  size_t           fields[3];
+  unsigned long    number;
+  bool             complete;
+
+  entries_.clear();
+
+  file_name = path(major, minor, build);
+
+  if (file_name.empty() || (file = fopen(file_name.c_str(), "rb")) == NULL) {
+    return false;
+  }
+
+  while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    contents.append(chunk, length);
+  }
+
+  fclose(file);
+
+  // Header, a line per procedure, then the count as a trailer //
+  complete = false;
+
+  for (start = 0; start < contents.size(); start = end + 1) {
+    end = contents.find('\n', start);
+    if (end == std::string::npos) {
+      break;
+    }
+
+    line = contents.substr(start, end - start);
+
+    if (start == 0) {
+      if (line != PIXY_CATALOG_HEADER) {
+        break;
+      }
+      continue;
+    }
+
+    if (line.compare(0, 4, "end ") == 0) {
+      // Nothing may follow the trailer //
+      complete = parse_number(line.substr(4), 0xffffffff, &number) &&
+                 number == entries_.size() && end + 1 == contents.size();
+      break;
+    }
+
+    fields[0] = line.find('\t');
+    fields[1] = fields[0] == std::string::npos ? fields[0] : line.find('\t', fields[0] + 1);
+    fields[2] = fields[1] == std::string::npos ? fields[1] : line.find('\t', fields[1] + 1);
+
+    if (fields[2] == std::string::npos || fields[1] == fields[0] + 1 ||
+        line.find('\t', fields[2] + 1) != std::string::npos ||
+        !parse_number(line.substr(0, fields[0]), 0x7fff, &number) ||
+        !from_hex(line.substr(fields[1] + 1, fields[2] - fields[1] - 1), &entry.arg_types)) {
+      break;
+    }
+
+    entry.id   = (ChirpProc) number;
+    entry.name = unescape(line.substr(fields[0] + 1, fields[1] - fields[0] - 1));
+    entry.info = unescape(line.substr(fields[2] + 1));
+
+    entries_.push_back(entry);
+  }
+
+  if (!complete) {
+    log("pixydebug: ProcCatalog::load() %s is damaged\n", file_name.c_str());
+    entries_.clear();
+    return false;
+  }
+
+  return true;
+}
+
+bool ProcCatalog::save(uint16_t major, uint16_t minor, uint16_t build)
+{
+  std::string file_name;
+  std::string temporary_name;
+  FILE *      file;
+  size_t      index;
+  bool        written;
+  char        suffix[64];
+
+  file_name = path(major, minor, build);
+
+  if (file_name.empty()) {
+    return false;
+  }
+
+  // Written aside and renamed into place, so processes connecting //
+  // meanwhile find either no catalog or a whole one               //
+  snprintf(suffix, sizeof(suffix), ".%d.%p.tmp", (int) getpid(), (void *) this);
+  temporary_name = file_name + suffix;
+
+  if ((file = fopen(temporary_name.c_str(), "wb")) == NULL) {
+    log("pixydebug: ProcCatalog::save() cannot write %s\n", temporary_name.c_str());
+    return false;
+  }
+
+  fprintf(file, "%s\n", PIXY_CATALOG_HEADER);
+
+  for (index = 0; index != entries_.size(); ++index) {
+    fprintf(file, "%d\t%s\t%s\t%s\n", entries_[index].id,
+            escape(entries_[index].name).c_str(),
+            to_hex(entries_[index].arg_types).c_str(),
+            escape(entries_[index].info).c_str());
+  }
+
+  fprintf(file, "end %u\n", (unsigned int) entries_.size());
+
+  written = ferror(file) == 0;
+  written = fclose(file) == 0 && written;
+
+  if (!written || rename(temporary_name.c_str(), file_name.c_str()) != 0) {
+    remove(temporary_name.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool ProcCatalog::add(Chirp * chirp, const char * name, ChirpProc id)
+{
+  ProcInfo         info;
+  ProcCatalogEntry entry;
+  size_t           index;
+
+  for (index = 0; index != entries_.size(); ++index) {
+    if (entries_[index].name == name) {
+      return false;
+    }
+  }
+
+  entry.id   = id;
+  entry.name = name;
+
+  info.procName = NULL;
+  info.argTypes = NULL;
+  info.procInfo = NULL;
+
+  // 'id' is in Pixy's table, so this is safe to ask for. Procedures //
+  // without info answer with an error, keep just their name then.   //
+  if (chirp->getProcInfo(id, &info) >= 0 && info.procName != NULL) {
+    entry.arg_types = info.argTypes ? (const char *) info.argTypes : "";
+    entry.info      = info.procInfo ? info.procInfo : "";
+  }
+
+  entries_.push_back(entry);
+
+  return true;
+}
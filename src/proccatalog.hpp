@@ -0,0 +1,97 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+#ifndef __PROCCATALOG_HPP__
+#define __PROCCATALOG_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "chirp.hpp"
+
+// A procedure as reported by CRP_CALL_ENUMERATE_INFO //
+struct ProcCatalogEntry
+{
+  std::string name;
+  ChirpProc   id;
+  std::string arg_types;
+  std::string info;
+};
+
+/**
+  @brief  The procedures of a Pixy firmware version, kept on disk.
+
+          Procedure ids only change with the firmware, so once a
+          procedure has been enumerated later connects to that version
+          can load its id instead of enumerating it again. Only
+          procedures Pixy resolved by name are recorded: asking for
+          ids past the end of its table hangs older firmware.
+          Catalogs are files named after the firmware version in the
+          directory set with set_directory(), none by default.
+*/
+class ProcCatalog
+{
+  public:
+
+    /**
+      @brief  Sets the directory catalogs are kept in, which must exist.
+              NULL or empty turns catalogs off.
+    */
+    static void set_directory(const char * directory);
+
+    /**
+      @brief  Whether a catalog directory is set.
+    */
+    static bool enabled();
+
+    /**
+      @brief  Reads the catalog of firmware 'major'.'minor'.'build'.
+      @return  true   Loaded
+      @return  false  No catalog for this version, or unreadable,
+                      damaged or truncated
+    */
+    bool load(uint16_t major, uint16_t minor, uint16_t build);
+
+    /**
+      @brief  Writes the catalog of firmware 'major'.'minor'.'build'.
+              Readers never see a partly written file.
+      @return  true   Saved
+    */
+    bool save(uint16_t major, uint16_t minor, uint16_t build);
+
+    /**
+      @brief  Records procedure 'name', which Pixy resolved to 'id',
+              with its argument types and info if Pixy reports them.
+      @return  true   Added
+      @return  false  Already in the catalog
+    */
+    bool add(Chirp * chirp, const char * name, ChirpProc id);
+
+    const std::vector<ProcCatalogEntry> & entries() const { return entries_; }
+
+  private:
+
+    static std::mutex  mutex_;
+    static std::string directory_;
+
+    std::vector<ProcCatalogEntry> entries_;
+
+    /**
+      @brief  File name of the catalog of a firmware version, empty if off.
+    */
+    static std::string path(uint16_t major, uint16_t minor, uint16_t build);
+};
+
+#endif
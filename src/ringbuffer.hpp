@@ -0,0 +1,87 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#ifndef __RINGBUFFER_HPP__
+#define __RINGBUFFER_HPP__
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+  @brief  Fixed-capacity FIFO of trivially copyable values.
+
+          Storage is allocated once, with the ring. Pushing onto a full
+          ring overwrites the oldest value, all in constant time.
+*/
+template <typename T, uint32_t CAPACITY>
+class RingBuffer
+{
+  public:
+
+    RingBuffer()
+    {
+      head_  = 0;
+      count_ = 0;
+    }
+
+    /**
+      @brief  Appends 'value', dropping the oldest value when full.
+    */
+    void push(const T & value)
+    {
+      values_[(head_ + count_) % CAPACITY] = value;
+
+      if (count_ == CAPACITY) {
+        head_ = (head_ + 1) % CAPACITY;
+      } else {
+        ++count_;
+      }
+    }
+
+    void clear()
+    {
+      head_  = 0;
+      count_ = 0;
+    }
+
+    uint32_t size() const { return count_; }
+
+    /**
+      @brief  Copies the values, oldest first, to 'destination' which
+              must have room for size() values.
+      @return Number of values copied
+    */
+    uint32_t copy(T * destination) const
+    {
+      uint32_t first;
+
+      // At most two contiguous runs: head to the end of storage, //
+      // then the start of storage.                                //
+      first = CAPACITY - head_ < count_ ? CAPACITY - head_ : count_;
+
+      memcpy(destination, values_ + head_, first * sizeof(T));
+      memcpy(destination + first, values_, (count_ - first) * sizeof(T));
+
+      return count_;
+    }
+
+  private:
+
+    T        values_[CAPACITY];
+    uint32_t head_;
+    uint32_t count_;
+};
+
+#endif
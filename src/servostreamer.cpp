@@ -0,0 +1,203 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+#include "servostreamer.hpp"
+#include "pixydefs.h"
+
+ServoStreamer::ServoStreamer()
+{
+  int channel;
+
+  rate_ = PIXY_RCS_DEFAULT_FREQUENCY;
+  next_ = 0;
+
+  for (channel = 0; channel != PIXY_RCS_CHANNELS; ++channel) {
+    channels_[channel].active = false;
+    channels_[channel].sent   = -1;
+    channels_[channel].count  = 0;
+  }
+}
+
+void ServoStreamer::set_rate(uint16_t rate)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  rate_ = rate;
+}
+
+int ServoStreamer::stream(uint8_t channel, const PixyServoWaypoint * waypoints, int count,
+                          int from, uint64_t now)
+{
+  int index;
+  int channel_index;
+  bool idle;
+
+  if (channel >= PIXY_RCS_CHANNELS || waypoints == 0 ||
+      count < 1 || count > PIXY_RCS_MAX_WAYPOINTS) {
+    return PIXY_ERROR_INVALID_PARAMETER;
+  }
+
+  for (index = 0; index != count; ++index) {
+    if (waypoints[index].position > PIXY_RCS_MAX_POS ||
+        (index > 0 && waypoints[index].time_ms < waypoints[index - 1].time_ms)) {
+      return PIXY_ERROR_INVALID_PARAMETER;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  Trajectory & trajectory = channels_[channel];
+
+  // A trajectory cut short continues from where it got to //
+  if (trajectory.active) {
+    from = sample(trajectory, (now - trajectory.start) / 1000);
+  } else if (trajectory.sent >= 0) {
+    from = trajectory.sent;
+  }
+
+  idle = true;
+  for (channel_index = 0; channel_index != PIXY_RCS_CHANNELS; ++channel_index) {
+    if (channels_[channel_index].active) {
+      idle = false;
+    }
+  }
+
+  trajectory.active = true;
+  trajectory.start  = now;
+  trajectory.from   = from;
+  trajectory.count  = count;
+
+  for (index = 0; index != count; ++index) {
+    trajectory.waypoints[index] = waypoints[index];
+  }
+
+  // Nothing was streaming, start right away //
+  if (idle) {
+    next_ = now;
+  }
+
+  return 0;
+}
+
+void ServoStreamer::stop(uint8_t channel)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // The position may be set by hand next, the last one sent //
+  // is no longer where the next trajectory starts            //
+  if (channel < PIXY_RCS_CHANNELS) {
+    channels_[channel].active = false;
+    channels_[channel].sent   = -1;
+  }
+}
+
+int ServoStreamer::position(uint8_t channel)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  return channel < PIXY_RCS_CHANNELS ? channels_[channel].sent : -1;
+}
+
+uint32_t ServoStreamer::next_update(uint64_t now)
+{
+  int channel;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (channel = 0; channel != PIXY_RCS_CHANNELS; ++channel) {
+    if (channels_[channel].active) {
+      // Rounded up, waking early would only find nothing to do //
+      return now >= next_ ? 0 : (next_ - now + 999) / 1000;
+    }
+  }
+
+  return 0xffffffff;
+}
+
+uint32_t ServoStreamer::update(uint64_t now, uint16_t limit, uint16_t positions[PIXY_RCS_CHANNELS])
+{
+  uint32_t changed;
+  uint32_t elapsed;
+  uint16_t rate;
+  uint64_t period;
+  int      channel;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (now < next_) {
+    return 0;
+  }
+
+  // Servos only take a new position once per PWM period //
+  rate   = rate_ < limit ? rate_ : limit;
+  period = 1000000 / (rate > 0 ? rate : 1);
+
+  // Late updates are not made up for //
+  next_ += period;
+  if (next_ <= now) {
+    next_ = now + period;
+  }
+
+  changed = 0;
+
+  for (channel = 0; channel != PIXY_RCS_CHANNELS; ++channel) {
+    Trajectory & trajectory = channels_[channel];
+
+    if (!trajectory.active) {
+      continue;
+    }
+
+    elapsed = (now - trajectory.start) / 1000;
+    positions[channel] = sample(trajectory, elapsed);
+
+    // The last waypoint is sent once more and holds //
+    if (elapsed >= trajectory.waypoints[trajectory.count - 1].time_ms) {
+      trajectory.active = false;
+    }
+
+    if (positions[channel] != trajectory.sent) {
+      trajectory.sent = positions[channel];
+      changed |= 1u << channel;
+    }
+  }
+
+  return changed;
+}
+
+uint16_t ServoStreamer::sample(const Trajectory & trajectory, uint32_t elapsed_ms)
+{
+  uint32_t previous_time;
+  int64_t  previous_position;
+  int64_t  next_position;
+  int      index;
+
+  previous_time     = 0;
+  previous_position = trajectory.from >= 0 ? trajectory.from : trajectory.waypoints[0].position;
+
+  for (index = 0; index != trajectory.count; ++index) {
+    const PixyServoWaypoint & waypoint = trajectory.waypoints[index];
+
+    if (elapsed_ms < waypoint.time_ms) {
+      // Linear between the waypoints either side //
+      next_position = waypoint.position;
+      return previous_position + (next_position - previous_position) *
+             (int64_t) (elapsed_ms - previous_time) / (int64_t) (waypoint.time_ms - previous_time);
+    }
+
+    previous_time     = waypoint.time_ms;
+    previous_position = waypoint.position;
+  }
+
+  return previous_position;
+}
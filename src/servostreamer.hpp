@@ -0,0 +1,100 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+#ifndef __SERVOSTREAMER_HPP__
+#define __SERVOSTREAMER_HPP__
+
+#include <stdint.h>
+#include <mutex>
+#include "pixy.h"
+
+/**
+  @brief  Samples servo trajectories at a fixed rate.
+
+          The application submits a trajectory per channel with stream();
+          the thread servicing the link asks next_update() how long it may
+          sleep and, once an update is due, takes the interpolated positions
+          from update() and sends the ones that changed.
+*/
+class ServoStreamer
+{
+  public:
+
+    ServoStreamer();
+
+    /**
+      @brief  Sets the update rate (Hz).
+    */
+    void set_rate(uint16_t rate);
+
+    /**
+      @brief  Replaces the trajectory of 'channel'.
+      @param[in] from  Position the servo is at, -1 if unknown (it then
+                       jumps to the first waypoint).
+      @param[in] now   Current time (us); waypoint times count from here.
+      @return  0                             Success
+      @return  PIXY_ERROR_INVALID_PARAMETER  Bad channel or waypoints
+    */
+    int stream(uint8_t channel, const PixyServoWaypoint * waypoints, int count,
+               int from, uint64_t now);
+
+    /**
+      @brief  Ends the trajectory of 'channel'. The next one starts
+              from the position passed to stream().
+    */
+    void stop(uint8_t channel);
+
+    /**
+      @brief  Last position sent for 'channel', -1 if none.
+    */
+    int position(uint8_t channel);
+
+    /**
+      @brief  Time until the next update is due (ms).
+      @return  0xffffffff  No trajectory in progress
+    */
+    uint32_t next_update(uint64_t now);
+
+    /**
+      @brief  Interpolates every trajectory in progress if an update is due.
+      @param[in]  limit      Highest rate allowed (Hz), the servo PWM frequency.
+      @param[out] positions  Position per channel.
+      @return     Bit per channel whose position changed and must be sent.
+    */
+    uint32_t update(uint64_t now, uint16_t limit, uint16_t positions[PIXY_RCS_CHANNELS]);
+
+  private:
+
+    struct Trajectory
+    {
+      bool              active;
+      uint64_t          start;      // us
+      int               from;       // Position at 'start', -1: unknown
+      int               sent;       // Last position sent, -1: none
+      int               count;
+      PixyServoWaypoint waypoints[PIXY_RCS_MAX_WAYPOINTS];
+    };
+
+    std::mutex mutex_;
+    Trajectory channels_[PIXY_RCS_CHANNELS];
+    uint16_t   rate_;
+    uint64_t   next_;               // When the next update is due (us)
+
+    /**
+      @brief  Position of 'trajectory' at 'elapsed_ms' after its start.
+    */
+    static uint16_t sample(const Trajectory & trajectory, uint32_t elapsed_ms);
+};
+
+#endif
@@ -0,0 +1,100 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+#ifndef __TRIPLEBUFFER_HPP__
+#define __TRIPLEBUFFER_HPP__
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+  @brief  Hands values from one writer thread to one reader thread
+          without either of them ever waiting on the other.
+
+          The writer fills back() and calls publish(), the reader calls
+          update() and reads front(). Of the three buffers one belongs to
+          the writer, one to the reader, and the third (the 'middle') holds
+          the latest published value. Publishing and picking up are a
+          single atomic exchange with the middle buffer, so a frame that is
+          never read is simply overwritten by the next one.
+*/
+template <typename T>
+class TripleBuffer
+{
+  public:
+
+    TripleBuffer() : middle_(1)
+    {
+      back_  = 0;
+      front_ = 2;
+    }
+
+    /**
+      @brief  Writer side: buffer to fill with the next value.
+    */
+    T & back() { return buffers_[back_]; }
+
+    /**
+      @brief  Writer side: makes back() the latest value and
+              hands the writer a free buffer in its place.
+    */
+    void publish()
+    {
+      back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /**
+      @brief  Whether a value was published since the reader last updated.
+    */
+    bool fresh() const
+    {
+      return middle_.load(std::memory_order_acquire) & FRESH;
+    }
+
+    /**
+      @brief  Reader side: moves the latest published value to front().
+      @return true   front() changed
+      @return false  Nothing new was published
+    */
+    bool update()
+    {
+      if (!fresh()) {
+        return false;
+      }
+
+      front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+      return true;
+    }
+
+    /**
+      @brief  Reader side: the value picked up by the last update().
+    */
+    const T & front() const { return buffers_[front_]; }
+
+  private:
+
+    enum
+    {
+      INDEX = 0x03,
+      FRESH = 0x04
+    };
+
+    T                    buffers_[3];
+    uint8_t              back_;
+    uint8_t              front_;
+    std::atomic<uint8_t> middle_;
+};
+
+#endif
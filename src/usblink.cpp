@@ -17,14 +17,29 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "usblink.h"
 #include "pixy.h"
 #include "utils/timer.hpp"
 #include "debuglog.h"
 
+#if defined(_WIN32) || defined(_WIN64)
+  #include "usleep.h"
+#endif
+
 std::mutex USBLink::set_mutex_;
 std::set<uint8_t> USBLink::devices_in_use_;
+std::mutex USBLink::context_mutex_;
+libusb_context *USBLink::context_ = 0;
+int USBLink::context_refs_ = 0;
+libusb_device **USBLink::device_list_ = 0;
+int USBLink::device_count_ = 0;
+util::timer USBLink::device_list_age_;
+libusb_hotplug_callback_handle USBLink::hotplug_handle_;
+bool USBLink::hotplug_ = false;
+std::atomic<bool> USBLink::devices_changed_(false);
+std::atomic<uint32_t> USBLink::arrivals_(0);
 
 USBLink::USBLink()
 {
@@ -34,6 +49,19 @@ USBLink::USBLink()
   m_context = 0;
   m_blockSize = 64;
   m_flags = LINK_FLAG_ERROR_CORRECTED;
+  queue_depth_ = USBLINK_RECEIVE_TRANSFERS;
+  staging_head_ = 0;
+  staging_count_ = 0;
+  active_transfers_ = 0;
+  receive_error_ = 0;
+  data_ready_ = 0;
+  woken_ = false;
+  cancelled_ = false;
+  lost_ = false;
+  fast_open_ = false;
+  reset_skipped_ = false;
+  bus_ = 0;
+  port_count_ = 0;
 }
 
 USBLink::~USBLink()
@@ -44,24 +72,51 @@ USBLink::~USBLink()
 int USBLink::open()
 {
   close();
+  cancelled_ = false;
 
-  libusb_init(&m_context);
+  m_context = acquireContext();
+  if (m_context == 0)
+    return LIBUSB_ERROR_OTHER;
+
+  int res = openDevice(false);
+  if (res < 0)
+    return res;
 
-  return openDevice();
+  return startReceiving();
+}
+
+int USBLink::reopen()
+{
+  if (m_context == 0)
+    return LIBUSB_ERROR_NO_DEVICE;
+
+  closeDevice();
+
+  int res = openDevice(true);
+  if (res < 0)
+    return res;
+
+  return startReceiving();
 }
 
 void USBLink::close()
 {
+  closeDevice();
+  if (m_context)
+  {
+    releaseContext();
+    m_context = 0;
+  }
+}
+
+void USBLink::closeDevice()
+{
+  stopReceiving();
   if (m_handle)
   {
     libusb_close(m_handle);
     m_handle = 0;
   }
-  if (m_context)
-  {
-    libusb_exit(m_context);
-    m_context = 0;
-  }
   if (open_) {
     set_mutex_.lock();
     devices_in_use_.erase(device_address_);
@@ -69,27 +124,142 @@ void USBLink::close()
   }
   device_address_ = 0;
   open_ = false;
+  lost_ = false;
+  reset_skipped_ = false;
 }
 
-int USBLink::numDevices()
+int USBLink::waitForArrival(uint16_t timeoutMs)
 {
-  libusb_device **list = NULL;
-  int count = 0;
-  int num_pixies = 0;
-  libusb_device *device;
+  util::timer elapsed;
+  uint32_t    arrivals = arrivals_;
+  uint32_t    waited;
+
+  if (!hotplug_)
+  {
+    // No hotplug notifications on this platform, caller polls //
+    while (!cancelled_ && (waited = elapsed.elapsed()) < timeoutMs)
+      usleep((timeoutMs - waited < 10 ? timeoutMs - waited : 10) * 1000);
+    return 1;
+  }
+
+  // Hotplug callbacks run from libusb event handling //
+  while (!cancelled_ && (waited = elapsed.elapsed()) < timeoutMs)
+  {
+    if (arrivals_ != arrivals)
+      return 1;
+
+    timeval tv;
+    tv.tv_sec  = (timeoutMs - waited) / 1000;
+    tv.tv_usec = ((timeoutMs - waited) % 1000) * 1000;
+    libusb_handle_events_timeout_completed(m_context, &tv, 0);
+  }
+  return arrivals_ != arrivals ? 1 : 0;
+}
+
+int LIBUSB_CALL USBLink::hotplugCallback(libusb_context *context, libusb_device *device,
+                                         libusb_hotplug_event event, void *user_data)
+{
+  // Only flag the change here, rescanning and opening happen outside //
+  // of libusb event handling.                                        //
+  devices_changed_ = true;
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+    arrivals_++;
+  return 0;
+}
+
+libusb_context *USBLink::acquireContext()
+{
+  std::lock_guard<std::mutex> lock(context_mutex_);
+
+  if (context_refs_ == 0)
+  {
+    if (libusb_init(&context_) < 0)
+    {
+      context_ = 0;
+      return 0;
+    }
+    hotplug_ = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+               libusb_hotplug_register_callback(context_,
+                 (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                 LIBUSB_HOTPLUG_NO_FLAGS, PIXY_VID, PIXY_PID, LIBUSB_HOTPLUG_MATCH_ANY,
+                 hotplugCallback, 0, &hotplug_handle_) == LIBUSB_SUCCESS;
+  }
+  context_refs_++;
+  return context_;
+}
+
+void USBLink::releaseContext()
+{
+  std::lock_guard<std::mutex> lock(context_mutex_);
+
+  if (context_refs_ == 0 || --context_refs_ > 0)
+    return;
+
+  if (device_list_)
+  {
+    libusb_free_device_list(device_list_, 1);
+    device_list_ = 0;
+    device_count_ = 0;
+  }
+  if (hotplug_)
+  {
+    libusb_hotplug_deregister_callback(context_, hotplug_handle_);
+    hotplug_ = false;
+  }
+  libusb_exit(context_);
+  context_ = 0;
+}
+
+int USBLink::pixyDevices(std::vector<libusb_device *> &devices)
+{
+  std::lock_guard<std::mutex> lock(context_mutex_);
   libusb_device_descriptor desc;
-  libusb_context *context;
 
-  libusb_init(&context);
-  count = libusb_get_device_list(context, &list);
-  for (int i = 0; i < count; i++)
+  devices.clear();
+
+  // Rescan the bus only when the cached list has gone stale //
+  if (device_list_ == 0 || devices_changed_.exchange(false) ||
+      device_list_age_.elapsed() > USBLINK_ENUMERATION_TTL)
+  {
+    libusb_device **list = NULL;
+    int count = libusb_get_device_list(context_, &list);
+    if (count < 0)
+      return count;
+    if (device_list_)
+      libusb_free_device_list(device_list_, 1);
+    device_list_ = list;
+    device_count_ = count;
+    device_list_age_.reset();
+  }
+
+  for (int i = 0; i < device_count_; i++)
   {
-    device = list[i];
-    libusb_get_device_descriptor(device, &desc);
+    libusb_get_device_descriptor(device_list_[i], &desc);
     if (desc.idVendor==PIXY_VID && desc.idProduct==PIXY_PID)
-      num_pixies++;
+      devices.push_back(libusb_ref_device(device_list_[i]));
   }
-  libusb_free_device_list(list, 1);
+  return devices.size();
+}
+
+void USBLink::unrefDevices(std::vector<libusb_device *> &devices)
+{
+  for (size_t i = 0; i < devices.size(); i++)
+    libusb_unref_device(devices[i]);
+  devices.clear();
+}
+
+int USBLink::numDevices()
+{
+  std::vector<libusb_device *> devices;
+  int num_pixies;
+
+  if (acquireContext() == 0)
+    return LIBUSB_ERROR_OTHER;
+
+  num_pixies = pixyDevices(devices);
+  unrefDevices(devices);
+  releaseContext();
+
   return num_pixies;
 }
 
@@ -101,55 +271,78 @@ int USBLink::numDevicesInUse()
   return devices_in_use;
 }
 
-int USBLink::openDevice()
+int USBLink::openDevice(bool samePort)
 {
-  libusb_device **list = NULL;
+  uint8_t ports[USBLINK_MAX_PORT_DEPTH];
+  int     port_count;
+  std::vector<libusb_device *> devices;
   int i, count = 0;
   libusb_device *device;
-  libusb_device_descriptor desc;
+  bool reserved;
 
 #ifdef __MACOS__
   const unsigned int MILLISECONDS_TO_SLEEP = 100;
 #endif
 
-  count = libusb_get_device_list(m_context, &list);
+  count = pixyDevices(devices);
 
   for (i=0; i<count; i++)
   {
-    device = list[i];
-    libusb_get_device_descriptor(device, &desc);
+    device = devices[i];
     const uint8_t device_address = libusb_get_device_address(device);
+    port_count = libusb_get_port_numbers(device, ports, USBLINK_MAX_PORT_DEPTH);
 
-    if (desc.idVendor==PIXY_VID && desc.idProduct==PIXY_PID)
+    // When reattaching, only accept the camera plugged into our old port //
+    if (samePort && (libusb_get_bus_number(device) != bus_ || port_count != port_count_ ||
+                     memcmp(ports, ports_, port_count_) != 0))
+      continue;
+
+    if (libusb_open(device, &m_handle)==0)
     {
-      if (libusb_open(device, &m_handle)==0)
+      // Reserve the camera first. Configuring and resetting it is slow, //
+      // other links may open other cameras meanwhile.                   //
+      set_mutex_.lock();
+      reserved = devices_in_use_.insert(device_address).second;
+      set_mutex_.unlock();
+      if (!reserved)
       {
+        libusb_close(m_handle);
+        m_handle = 0;
+        continue;
+      }
 #ifdef __MACOS__
+      if (!fast_open_)
+      {
         libusb_reset_device(m_handle);
         usleep(MILLISECONDS_TO_SLEEP * 1000);
+      }
 #endif
+      if ((libusb_set_configuration(m_handle, 1) < 0) ||
+          (libusb_claim_interface(m_handle, 1) < 0)) {
+        libusb_close(m_handle);
+        m_handle = 0;
         set_mutex_.lock();
-        if ((devices_in_use_.find(device_address) != devices_in_use_.cend()) ||
-            (libusb_set_configuration(m_handle, 1) < 0) ||
-            (libusb_claim_interface(m_handle, 1) < 0)) {
-          libusb_close(m_handle);
-          m_handle = 0;
-          set_mutex_.unlock();
-          continue;
-        }
+        devices_in_use_.erase(device_address);
+        set_mutex_.unlock();
+        continue;
+      }
 #ifdef __LINUX__
+      if (!fast_open_)
         libusb_reset_device(m_handle);
 #endif
-        devices_in_use_.insert(device_address);
-        device_address_ = device_address;
-        set_mutex_.unlock();
-        open_ = true;
-        break;
-      }
+#if defined(__LINUX__) || defined(__MACOS__)
+      reset_skipped_ = fast_open_;
+#endif
+      device_address_ = device_address;
+      bus_ = libusb_get_bus_number(device);
+      port_count_ = port_count < 0 ? 0 : port_count;
+      memcpy(ports_, ports, port_count_);
+      open_ = true;
+      break;
     }
   }
-  libusb_free_device_list(list, 1);
-  if (i==count) // no devices found
+  unrefDevices(devices);
+  if (i>=count) // no devices found
     return -1;
   return 0;
 }
@@ -163,8 +356,13 @@ int USBLink::send(const uint8_t *data, uint32_t len, uint16_t timeoutMs)
   if (timeoutMs==0) // 0 equals infinity
     timeoutMs = 10;
 
+  if (!m_handle)
+    return LIBUSB_ERROR_NO_DEVICE;
+
   if ((res=libusb_bulk_transfer(m_handle, 0x02, (unsigned char *)data, len, &transferred, timeoutMs))<0)
   {
+    if (res == LIBUSB_ERROR_NO_DEVICE)
+      lost_ = true;
 #ifdef __MACOS__
     libusb_clear_halt(m_handle, 0x02);
 #endif
@@ -183,11 +381,22 @@ int USBLink::receive(uint8_t *data, uint32_t len, uint16_t timeoutMs)
   if (timeoutMs==0) // 0 equals infinity
     timeoutMs = 50;
 
+  if (!m_handle)
+    return LIBUSB_ERROR_NO_DEVICE;
+
+  if (!transfers_.empty())
+    return receiveQueued(data, len, timeoutMs);
+
+  if (cancelled_)
+    return LIBUSB_ERROR_TIMEOUT;
+
   // Note: if this call is taking more time than than expected, check to see if we're connected as USB 2.0.  Bad USB cables can
   // cause us to revert to a 1.0 connection.
   if ((res=libusb_bulk_transfer(m_handle, 0x82, (unsigned char *)data, len, &transferred, timeoutMs))<0)
   {
     log("pixydebug: libusb_bulk_transfer() = %d\n", res);
+    if (res == LIBUSB_ERROR_NO_DEVICE)
+      lost_ = true;
 #ifdef __MACOS__
     libusb_clear_halt(m_handle, 0x82);
 #endif
@@ -196,6 +405,423 @@ int USBLink::receive(uint8_t *data, uint32_t len, uint16_t timeoutMs)
   return transferred;
 }
 
+int USBLink::reset()
+{
+  int res;
+
+  if (!m_handle)
+    return LIBUSB_ERROR_NO_DEVICE;
+
+  stopReceiving();
+  res = libusb_reset_device(m_handle);
+#ifdef __MACOS__
+  usleep(100 * 1000);
+#endif
+  reset_skipped_ = false;
+  if (res < 0)
+    return res;
+
+  return startReceiving();
+}
+
+int USBLink::setReceiveQueue(uint8_t transfers)
+{
+  queue_depth_ = transfers;
+
+  if (!m_handle)
+    return 0;
+
+  stopReceiving();
+  return startReceiving();
+}
+
+int USBLink::waitForData(uint16_t timeoutMs)
+{
+  util::timer elapsed;
+  uint32_t    waited;
+  bool        handled = false;
+  int         res;
+
+  if (transfers_.empty())
+    return 1;
+
+  while (true)
+  {
+    staging_mutex_.lock();
+    data_ready_ = 0;
+    flushUnstaged();
+    if (staging_count_ > 0 || receive_error_)
+    {
+      res = staging_count_ > 0 ? (int)staging_count_ : receive_error_;
+      staging_mutex_.unlock();
+      return res;
+    }
+    staging_mutex_.unlock();
+
+    if (woken_.exchange(false) || cancelled_)
+      return 0;
+
+    // Events are handled at least once, so a zero timeout still picks //
+    // up transfers that completed since the last call.                 //
+    waited = elapsed.elapsed();
+    if (waited >= timeoutMs && handled)
+      return 0;
+    if (waited > timeoutMs)
+      waited = timeoutMs;
+
+    timeval tv;
+    tv.tv_sec  = (timeoutMs - waited) / 1000;
+    tv.tv_usec = ((timeoutMs - waited) % 1000) * 1000;
+    res = libusb_handle_events_timeout_completed(m_context, &tv, &data_ready_);
+    if (res<0 && res!=LIBUSB_ERROR_INTERRUPTED)
+      return res;
+    handled = true;
+  }
+}
+
+void USBLink::wake()
+{
+  woken_ = true;
+
+  // Whichever thread handles events on the shared context returns, and //
+  // any waitForData() blocked behind it rechecks 'woken_'.             //
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+  if (m_context)
+    libusb_interrupt_event_handler(m_context);
+#endif
+}
+
+void USBLink::cancel()
+{
+  cancelled_ = true;
+  wake();
+}
+
+int USBLink::handleEvents(uint16_t timeoutMs)
+{
+  libusb_context *context;
+  timeval tv;
+  int res;
+
+  if ((context=acquireContext())==0)
+    return LIBUSB_ERROR_OTHER;
+
+  tv.tv_sec  = timeoutMs / 1000;
+  tv.tv_usec = (timeoutMs % 1000) * 1000;
+  res = libusb_handle_events_timeout(context, &tv);
+
+  releaseContext();
+
+  // Cut short by a link's wake() //
+  if (res==LIBUSB_ERROR_INTERRUPTED)
+    return 0;
+  return res;
+}
+
+int USBLink::pollfds(std::vector<libusb_pollfd> &fds)
+{
+  const libusb_pollfd **list;
+  int i;
+
+  fds.clear();
+
+  if (!m_context)
+    return LIBUSB_ERROR_NO_DEVICE;
+
+  // NULL where libusb can't expose its fds (Windows) //
+  if ((list=libusb_get_pollfds(m_context))==NULL)
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+
+  for (i=0; list[i]; i++)
+    fds.push_back(*list[i]);
+
+  libusb_free_pollfds(list);
+
+  return 0;
+}
+
+int USBLink::nextTimeout(uint32_t *timeoutMs)
+{
+  timeval tv;
+  int res;
+
+  if (!m_context)
+    return LIBUSB_ERROR_NO_DEVICE;
+
+  if ((res=libusb_get_next_timeout(m_context, &tv))<=0)
+    return res;
+
+  // Round up so the caller doesn't wake before the deadline //
+  *timeoutMs = tv.tv_sec*1000 + (tv.tv_usec+999)/1000;
+  return 1;
+}
+
+uint32_t USBLink::pending()
+{
+  uint32_t count;
+
+  staging_mutex_.lock();
+  flushUnstaged();
+  count = staging_count_;
+  staging_mutex_.unlock();
+
+  return count;
+}
+
+int USBLink::startReceiving()
+{
+  libusb_transfer *transfer;
+  int res;
+
+  if (queue_depth_==0 || !m_handle)
+    return 0;
+
+  staging_.resize(2 * queue_depth_ * USBLINK_TRANSFER_SIZE);
+  staging_head_ = 0;
+  staging_count_ = 0;
+  receive_error_ = 0;
+
+  for (int i = 0; i < queue_depth_; i++)
+  {
+    transfer = libusb_alloc_transfer(0);
+    if (transfer == 0)
+    {
+      stopReceiving();
+      return LIBUSB_ERROR_NO_MEM;
+    }
+    libusb_fill_bulk_transfer(transfer, m_handle, 0x82, new uint8_t[USBLINK_TRANSFER_SIZE],
+                              USBLINK_TRANSFER_SIZE, transferCallback, this, 0);
+    transfers_.push_back(transfer);
+  }
+
+  staging_mutex_.lock();
+  for (size_t i = 0; i < transfers_.size(); i++)
+  {
+    if ((res=submitTransfer(transfers_[i]))<0)
+      log("pixydebug: libusb_submit_transfer() = %d\n", res);
+  }
+  bool submitted = active_transfers_ > 0;
+  staging_mutex_.unlock();
+
+  // Nothing in flight, fall back to synchronous transfers. //
+  if (!submitted)
+    stopReceiving();
+
+  return 0;
+}
+
+void USBLink::stopReceiving()
+{
+  size_t i;
+
+  if (transfers_.empty())
+    return;
+
+  staging_mutex_.lock();
+  for (i = 0; i < transfers_.size(); i++)
+    libusb_cancel_transfer(transfers_[i]);
+  staging_mutex_.unlock();
+
+  // Let the cancellations complete before the buffers go away. //
+  bool idle = false;
+  while (true)
+  {
+    staging_mutex_.lock();
+    idle = active_transfers_ == 0;
+    staging_mutex_.unlock();
+    if (idle)
+      break;
+
+    timeval tv = {0, 100000};
+    int res = libusb_handle_events_timeout_completed(m_context, &tv, 0);
+    if (res<0 && res!=LIBUSB_ERROR_INTERRUPTED)
+    {
+      log("pixydebug: libusb_handle_events_timeout_completed() = %d\n", res);
+      break;
+    }
+  }
+
+  // Transfers still in flight belong to libusb, leak them rather than free them. //
+  if (idle)
+  {
+    for (i = 0; i < transfers_.size(); i++)
+    {
+      delete[] transfers_[i]->buffer;
+      libusb_free_transfer(transfers_[i]);
+    }
+  }
+  transfers_.clear();
+  idle_.clear();
+  unstaged_.clear();
+  staging_count_ = 0;
+  active_transfers_ = 0;
+}
+
+int USBLink::submitTransfer(libusb_transfer *transfer)
+{
+  int res = libusb_submit_transfer(transfer);
+
+  if (res<0)
+  {
+    idle_.push_back(transfer);
+    return res;
+  }
+
+  active_transfers_++;
+  return 0;
+}
+
+bool USBLink::stageTransfer(libusb_transfer *transfer)
+{
+  uint32_t length = transfer->actual_length;
+  uint32_t tail, first;
+
+  if (length > staging_.size() - staging_count_)
+    return false;
+
+  // Copy into the ring, wrapping at the end of the buffer //
+  tail  = (staging_head_ + staging_count_) % staging_.size();
+  first = staging_.size() - tail;
+  if (first > length)
+    first = length;
+  memcpy(&staging_[tail], transfer->buffer, first);
+  memcpy(&staging_[0], transfer->buffer + first, length - first);
+  staging_count_ += length;
+
+  return true;
+}
+
+void USBLink::flushUnstaged()
+{
+  while (!unstaged_.empty() && stageTransfer(unstaged_.front()))
+  {
+    libusb_transfer *transfer = unstaged_.front();
+    unstaged_.pop_front();
+    submitTransfer(transfer);
+  }
+}
+
+void LIBUSB_CALL USBLink::transferCallback(libusb_transfer *transfer)
+{
+  USBLink *link = static_cast<USBLink *>(transfer->user_data);
+  std::lock_guard<std::mutex> lock(link->staging_mutex_);
+
+  link->active_transfers_--;
+
+  switch (transfer->status)
+  {
+    case LIBUSB_TRANSFER_COMPLETED:
+      // Keep ordering: only stage directly if nothing is waiting ahead of us //
+      if (link->unstaged_.empty() && link->stageTransfer(transfer))
+        link->submitTransfer(transfer);
+      else
+        link->unstaged_.push_back(transfer);
+      break;
+
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      link->submitTransfer(transfer);
+      break;
+
+    case LIBUSB_TRANSFER_CANCELLED:
+      break;
+
+    case LIBUSB_TRANSFER_STALL:
+      link->receive_error_ = LIBUSB_ERROR_PIPE;
+      link->idle_.push_back(transfer);
+      break;
+
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      link->receive_error_ = LIBUSB_ERROR_NO_DEVICE;
+      link->lost_ = true;
+      break;
+
+    case LIBUSB_TRANSFER_OVERFLOW:
+      link->receive_error_ = LIBUSB_ERROR_OVERFLOW;
+      link->idle_.push_back(transfer);
+      break;
+
+    default:
+      link->receive_error_ = LIBUSB_ERROR_IO;
+      link->idle_.push_back(transfer);
+      break;
+  }
+
+  link->data_ready_ = 1;
+}
+
+int USBLink::receiveQueued(uint8_t *data, uint32_t len, uint16_t timeoutMs)
+{
+  util::timer elapsed;
+  uint32_t    wanted, copied, first;
+  int         res;
+
+  // Deliver at least one packet's worth (or everything that was asked  //
+  // for, if less) so callers see the same framing as a bulk transfer.  //
+  wanted = len < m_blockSize ? len : m_blockSize;
+
+  while (true)
+  {
+    staging_mutex_.lock();
+    data_ready_ = 0;
+    flushUnstaged();
+
+    if (staging_count_ >= wanted)
+      break;
+
+    if (receive_error_)
+    {
+      res = receive_error_;
+      receive_error_ = 0;
+#ifdef __MACOS__
+      if (res == LIBUSB_ERROR_PIPE)
+        libusb_clear_halt(m_handle, 0x82);
+#endif
+      // Put stalled transfers back in flight for the next attempt //
+      std::vector<libusb_transfer *> idle;
+      idle.swap(idle_);
+      for (size_t i = 0; i < idle.size(); i++)
+        submitTransfer(idle[i]);
+      staging_mutex_.unlock();
+      log("pixydebug: USBLink::receive() transfer error %d\n", res);
+      return res;
+    }
+    staging_mutex_.unlock();
+
+    uint32_t waited = elapsed.elapsed();
+    if (waited >= timeoutMs || cancelled_)
+    {
+      staging_mutex_.lock();
+      if (staging_count_ > 0)
+        break;
+      staging_mutex_.unlock();
+      return LIBUSB_ERROR_TIMEOUT;
+    }
+
+    timeval tv;
+    tv.tv_sec  = (timeoutMs - waited) / 1000;
+    tv.tv_usec = ((timeoutMs - waited) % 1000) * 1000;
+    res = libusb_handle_events_timeout_completed(m_context, &tv, &data_ready_);
+    if (res<0 && res!=LIBUSB_ERROR_INTERRUPTED)
+      return res;
+  }
+
+  // Copy out of the ring (staging_mutex_ is held) //
+  copied = len < staging_count_ ? len : staging_count_;
+  first  = staging_.size() - staging_head_;
+  if (first > copied)
+    first = copied;
+  memcpy(data, &staging_[staging_head_], first);
+  memcpy(data + first, &staging_[0], copied - first);
+  staging_head_   = (staging_head_ + copied) % staging_.size();
+  staging_count_ -= copied;
+
+  // Space was freed, move any waiting transfers along //
+  flushUnstaged();
+  staging_mutex_.unlock();
+
+  return copied;
+}
+
 void USBLink::setTimer()
 {
   timer_.reset();
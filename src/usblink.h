@@ -17,13 +17,27 @@
 #define _USBLINK_H
 
 #include <set>
+#include <deque>
+#include <vector>
 #include <mutex>
+#include <atomic>
 
 #include <link.h>
 
 #include "utils/timer.hpp"
 #include "libusb.h"
 
+// Number of bulk-IN transfers kept posted on the Pixy endpoint. //
+// 0 selects the synchronous libusb_bulk_transfer() receive path. //
+#define USBLINK_RECEIVE_TRANSFERS     4
+#define USBLINK_TRANSFER_SIZE         0x1000
+
+// How long a bus enumeration is reused before the bus is rescanned (ms) //
+#define USBLINK_ENUMERATION_TTL       500
+
+// USB 3.0 allows hub chains up to 7 deep //
+#define USBLINK_MAX_PORT_DEPTH        7
+
 class USBLink : public Link
 {
 public:
@@ -32,25 +46,192 @@ public:
 
   int open();
   void close();
+
+  /**
+    @brief  Releases the current device and claims the Pixy on the same
+            bus and port again, e.g. after it was unplugged and came back.
+    @return  0         Success
+    @return  Negative  Camera not (yet) present, or libusb error
+  */
+  int reopen();
+
+  /**
+    @brief  Fast open: open() and reopen() skip the device reset (and on
+            macOS the settle time after it). Only safe if the camera is in
+            a clean state, i.e. its last user closed it properly; if it
+            does not answer afterwards, reset() it.
+  */
+  void setFastOpen(bool enable) { fast_open_ = enable; }
+
+  /**
+    @brief  True if the device was opened without the reset it would
+            normally get.
+  */
+  bool resetSkipped() const { return reset_skipped_; }
+
+  /**
+    @brief  Resets the open device, keeping it claimed.
+    @return  0         Success
+    @return  Negative  libusb error
+  */
+  int reset();
+
+  /**
+    @brief  Blocks until a Pixy is plugged in, or 'timeoutMs' elapses.
+            Without hotplug support this simply sleeps for 'timeoutMs'.
+    @return  1  A Pixy may have arrived, try reopen()
+    @return  0  Timed out
+  */
+  int waitForArrival(uint16_t timeoutMs);
+
+  /**
+    @brief  True once libusb has reported the device as gone.
+  */
+  bool lost() const { return lost_; }
   virtual int send(const uint8_t *data, uint32_t len, uint16_t timeoutMs);
   virtual int receive(uint8_t *data, uint32_t len, uint16_t timeoutMs);
   virtual void setTimer();
   virtual uint32_t getTimer();
   uint8_t device_address() const { return device_address_; }
 
+  /**
+    @brief  Sets the number of bulk-IN transfers kept in flight.
+            Takes effect immediately if the link is open.
+    @param[in] transfers  0 disables the queue and receives synchronously.
+    @return  0         Success
+    @return  Negative  libusb error while (re)starting the queue
+  */
+  int setReceiveQueue(uint8_t transfers);
+
+  /**
+    @brief  Blocks on libusb events until received data is staged.
+    @param[in] timeoutMs  Maximum time to wait.
+    @return  Positive  Bytes ready to be received (always 1 when the
+                       receive queue is disabled and availability is unknown)
+    @return  0         Timed out
+    @return  Negative  A queued transfer failed, receive() reports it
+  */
+  virtual int waitForData(uint16_t timeoutMs);
+
+  /**
+    @brief  Number of received bytes staged and not yet handed to receive().
+  */
+  virtual uint32_t pending();
+
+  /**
+    @brief  Makes waitForData() return early, from any thread. Blocked in
+            libusb it only returns this soon with libusb 1.0.21 or later,
+            before that once its timeout is up.
+  */
+  virtual void wake();
+
+  /**
+    @brief  Cancels receiving, from any thread, until the link is next
+            opened: receive() and waitForData() return at once with
+            what was already staged, and so does waitForArrival().
+            A synchronous bulk transfer (receive queue disabled) that
+            is already in progress still runs to its timeout.
+  */
+  virtual void cancel();
+
+  bool queued() const { return !transfers_.empty(); }
+
+  /**
+    @brief  Handles libusb events for every open link, returning once
+            some event was handled or 'timeoutMs' elapses. Lets one
+            thread service the receive queues of many links.
+    @return  0         Success or timeout
+    @return  Negative  libusb error
+  */
+  static int handleEvents(uint16_t timeoutMs);
+
+  /**
+    @brief  File descriptors libusb wants polled for this link's events,
+            for callers that run their own poll loop.
+    @return  0                          Success
+    @return  LIBUSB_ERROR_NOT_SUPPORTED The platform has no pollable fds
+  */
+  int pollfds(std::vector<libusb_pollfd> &fds);
+
+  /**
+    @brief  Time until libusb next needs its events handled even if no
+            file descriptor became ready.
+    @return  1         'timeoutMs' was set
+    @return  0         No deadline pending
+    @return  Negative  libusb error
+  */
+  int nextTimeout(uint32_t *timeoutMs);
+
   static int numDevices();
   static int numDevicesInUse();
 
 private:
   static std::mutex set_mutex_;
   static std::set<uint8_t> devices_in_use_;
+
+  // One libusb context is shared by every link in the process. It is //
+  // created by the first reference and destroyed with the last one.  //
+  static std::mutex context_mutex_;
+  static libusb_context *context_;
+  static int context_refs_;
+  static libusb_device **device_list_;
+  static int device_count_;
+  static util::timer device_list_age_;
+
+  static libusb_context *acquireContext();
+  static void releaseContext();
+  // Fills 'devices' with referenced Pixy devices from the cached bus //
+  // enumeration. Release them with unrefDevices().                  //
+  static int pixyDevices(std::vector<libusb_device *> &devices);
+  static void unrefDevices(std::vector<libusb_device *> &devices);
   
-  int openDevice();
+  static libusb_hotplug_callback_handle hotplug_handle_;
+  static bool hotplug_;
+  static std::atomic<bool> devices_changed_;
+  static std::atomic<uint32_t> arrivals_;
+  static int LIBUSB_CALL hotplugCallback(libusb_context *context, libusb_device *device,
+                                         libusb_hotplug_event event, void *user_data);
+
+  int openDevice(bool samePort);
+  void closeDevice();
+  int startReceiving();
+  void stopReceiving();
+  int submitTransfer(libusb_transfer *transfer);
+  bool stageTransfer(libusb_transfer *transfer);
+  void flushUnstaged();
+  int receiveQueued(uint8_t *data, uint32_t len, uint16_t timeoutMs);
+  static void LIBUSB_CALL transferCallback(libusb_transfer *transfer);
+
   libusb_context *m_context;
   libusb_device_handle *m_handle;
   util::timer timer_;
   uint8_t device_address_;
   bool open_;
+  std::atomic<bool> lost_;
+  bool fast_open_;
+  bool reset_skipped_;
+
+  // Physical location of the claimed camera, used to reattach it //
+  uint8_t bus_;
+  uint8_t ports_[USBLINK_MAX_PORT_DEPTH];
+  int port_count_;
+
+  // Asynchronous receive state. Completed transfers are copied into //
+  // the 'staging_' ring, which receive() drains in order. Transfers  //
+  // that complete while the ring is full wait in 'unstaged_'.        //
+  uint8_t queue_depth_;
+  std::vector<libusb_transfer *> transfers_;
+  std::vector<libusb_transfer *> idle_;
+  std::deque<libusb_transfer *> unstaged_;
+  std::vector<uint8_t> staging_;
+  uint32_t staging_head_;
+  uint32_t staging_count_;
+  int active_transfers_;
+  int receive_error_;
+  int data_ready_;
+  std::atomic<bool> woken_;
+  std::atomic<bool> cancelled_;
+  std::mutex staging_mutex_;
 };
 #endif
 
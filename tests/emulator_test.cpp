@@ -0,0 +1,690 @@
+//
+// begin license header
+//
+// This file is part of Pixy CMUcam5 or "Pixy" for short
+//
+// All Pixy source code is provided under the terms of the
+// GNU General Public License v2 (http://www.gnu.org/licenses/gpl-2.0.html).
+// Those wishing to use Pixy source code, software and/or
+// technologies under different licensing terms should contact us at
+// cmucam@cs.cmu.edu. Such licensing terms are available for
+// all portions of the Pixy codebase presented here.
+//
+// end license header
+//
+
+// Runs the whole stack against the emulated Pixy: opens the camera, //
+// reads frames and calls procedures end to end. No camera needed.    //
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pixyhandle.hpp"
+#include "pixyinterpreter.hpp"
+#include "proccatalog.hpp"
+
+#define FRAME_RATE         100
+#define NORMAL_BLOCKS      3
+#define COLOR_CODE_BLOCKS  2
+#define WAIT_TIMEOUT       1000
+#define CAMERAS            4
+#define SLOW_FRAME_RATE    10
+
+static int failures = 0;
+
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+// Procedure calls the emulator served, this one included //
+static uint32_t emulator_calls(PixyHandle & pixy)
+{
+  uint32_t calls = 0;
+
+  CHECK(pixy.command("emu_getCalls", END_OUT_ARGS, &calls, END_IN_ARGS) >= 0);
+
+  return calls;
+}
+
+static void test_blocks(PixyHandle & pixy)
+{
+  struct Block     blocks[NORMAL_BLOCKS + COLOR_CODE_BLOCKS];
+  struct PixyFrame frame;
+  int              normal;
+  int              color_code;
+  int              index;
+
+  CHECK(pixy.wait_for_blocks(WAIT_TIMEOUT) > 0);
+  CHECK(pixy.get_blocks(NORMAL_BLOCKS + COLOR_CODE_BLOCKS, blocks) == NORMAL_BLOCKS + COLOR_CODE_BLOCKS);
+
+  CHECK(pixy.wait_for_blocks(WAIT_TIMEOUT) > 0);
+  CHECK(pixy.get_frame(&frame) >= 0);
+  CHECK(frame.sequence > 0);
+  CHECK(frame.number_of_blocks == NORMAL_BLOCKS + COLOR_CODE_BLOCKS);
+
+  normal     = 0;
+  color_code = 0;
+
+  for (index = 0; index != frame.number_of_blocks; ++index) {
+    if (frame.blocks[index].type == PIXY_BLOCKTYPE_NORMAL) {
+      CHECK(frame.blocks[index].width == 20 && frame.blocks[index].height == 20);
+      normal++;
+    } else {
+      CHECK(frame.blocks[index].width == 30 && frame.blocks[index].height == 30);
+      color_code++;
+    }
+  }
+
+  CHECK(normal == NORMAL_BLOCKS);
+  CHECK(color_code == COLOR_CODE_BLOCKS);
+}
+
+static void test_commands(PixyHandle & pixy)
+{
+  uint16_t major;
+  uint16_t minor;
+  uint16_t build;
+
+  CHECK(pixy.get_firmware_version(&major, &minor, &build) == 0);
+  CHECK(major == 2 && minor == 0 && build == 19);
+
+  CHECK(pixy.rcs_set_position(1, 700) >= 0);
+  CHECK(pixy.rcs_get_position(1) == 700);
+
+  CHECK(pixy.set_brightness(42) >= 0);
+  CHECK(pixy.get_brightness() == 42);
+}
+
+static void test_open_all()
+{
+  std::vector<PixyHandle> handles;
+  std::atomic<int>        opens(0);
+  std::mutex              failed_mutex;
+  PixyHandle              failed;
+  size_t                  index;
+
+  // One camera opens, then fails: open_all() must close it //
+  CHECK(PixyHandle::open_all(handles, CAMERAS, [&](PixyHandle & pixy) {
+    int result = pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS);
+
+    if (result == 0 && ++opens == 2) {
+      std::lock_guard<std::mutex> lock(failed_mutex);
+      failed = pixy;
+      return PIXY_ERROR_CHIRP;
+    }
+    return result;
+  }) == CAMERAS - 1);
+
+  CHECK(handles.size() == CAMERAS - 1);
+  CHECK(failed.rcs_get_position(1) < 0);
+
+  for (index = 0; index != handles.size(); ++index) {
+    CHECK(handles[index].wait_for_blocks(WAIT_TIMEOUT) > 0);
+    CHECK(handles[index].rcs_set_position(1, 100 + index) >= 0);
+  }
+
+  // Each camera is its own emulator //
+  for (index = 0; index != handles.size(); ++index) {
+    CHECK(handles[index].rcs_get_position(1) == (int) (100 + index));
+    handles[index].close();
+  }
+
+  // None opened //
+  CHECK(PixyHandle::open_all(handles, CAMERAS, [](PixyHandle &) {
+    return PIXY_ERROR_USB_NOT_FOUND;
+  }) == PIXY_ERROR_USB_NOT_FOUND);
+  CHECK(handles.empty());
+}
+
+// Coalesced setters: only the newest value is sent, ahead of the next command //
+static void test_coalescing(PixyThreading threading)
+{
+  PixyHandle pixy;
+  uint32_t   calls;
+  int        value;
+
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS, threading) == 0);
+  CHECK(pixy.set_coalescing(true) == 0);
+
+  calls = emulator_calls(pixy);
+
+  for (value = 10; value <= 50; value += 10) {
+    CHECK(pixy.set_brightness(value) == 0);
+  }
+
+  CHECK(pixy.get_brightness() == 50);
+
+  if (threading == PIXY_THREAD_NONE) {
+    // Nothing is sent until the getter: one setter call, the getter, the count //
+    CHECK(emulator_calls(pixy) - calls == 3);
+  } else {
+    // The interpreter thread may have sent some before the rest came in //
+    CHECK(emulator_calls(pixy) - calls <= 7);
+  }
+
+  CHECK(pixy.close() == 0);
+}
+
+// Cached getters answer without a call to the emulator, which counts them //
+static void test_settings_cache()
+{
+  PixyHandle      pixy;
+  PixyInterpreter interpreter;
+  uint32_t        calls;
+  uint32_t        cached;
+
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+
+  // Off: every getter is a round trip //
+  calls = emulator_calls(pixy);
+  CHECK(pixy.get_brightness() == 80);
+  CHECK(emulator_calls(pixy) - calls == 2);
+
+  // On: filled once, then hits, written through by setters //
+  CHECK(pixy.set_settings_cache(true) == 0);
+  calls = emulator_calls(pixy);
+  CHECK(pixy.get_brightness() == 80);
+  CHECK(pixy.rcs_get_position(1) == PIXY_RCS_CENTER_POS);
+  CHECK(emulator_calls(pixy) - calls == 1);
+
+  CHECK(pixy.set_brightness(33) >= 0);
+  calls = emulator_calls(pixy);
+  CHECK(pixy.get_brightness() == 33);
+  CHECK(emulator_calls(pixy) - calls == 1);
+
+  // Pixy keeps changing the white balance while AWB is on: the value //
+  // is only cached with AWB off                                      //
+  CHECK(pixy.set_auto_white_balance(0) >= 0);
+  CHECK(pixy.set_white_balance_value(0x12, 0x34, 0x56) >= 0);
+  calls = emulator_calls(pixy);
+  CHECK(pixy.get_white_balance_value() == 0x561234);
+  CHECK(emulator_calls(pixy) - calls == 1);
+
+  CHECK(pixy.set_auto_white_balance(1) >= 0);
+  calls = emulator_calls(pixy);
+  CHECK(pixy.get_white_balance_value() == 0x561234);
+  CHECK(pixy.get_white_balance_value() == 0x561234);
+  CHECK(emulator_calls(pixy) - calls == 3);
+
+  CHECK(pixy.close() == 0);
+
+  // close() clears the cache: nothing is served from it until refilled //
+  CHECK(interpreter.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+  interpreter.set_caching(true);
+  CHECK(interpreter.cache_lookup(PIXY_SETTING_BRIGHTNESS, &cached));
+  CHECK(interpreter.close() == 0);
+  CHECK(!interpreter.cache_lookup(PIXY_SETTING_BRIGHTNESS, &cached));
+  CHECK(interpreter.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+  CHECK(!interpreter.cache_lookup(PIXY_SETTING_BRIGHTNESS, &cached));
+  CHECK(interpreter.close() == 0);
+}
+
+// Commands posted while the interpreter thread is held up by an async //
+// command: past their deadline they fail, high priority goes first.   //
+static void test_priorities()
+{
+  PixyHandle       pixy;
+  std::atomic<int> finished(0);
+  int              normal_order;
+  int              high_order;
+  int              expired;
+  int              expired_default;
+  int32_t          response;
+
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+
+  std::future<int> busy = pixy.command_async([](PixyHandle &) {
+    usleep(300000);
+    return 0;
+  });
+
+  CHECK(pixy.set_command_deadline(PIXY_PRIORITY_LOW, 20) == 0);
+  usleep(50000);
+
+  std::thread normal([&] {
+    pixy.command(PIXY_PRIORITY_NORMAL, 0, "cam_getBrightness", END_OUT_ARGS, &response, END_IN_ARGS);
+    normal_order = ++finished;
+  });
+  std::thread deadline([&] {
+    int32_t brightness;
+
+    expired = pixy.command(PIXY_PRIORITY_NORMAL, 20, "cam_getBrightness", END_OUT_ARGS, &brightness, END_IN_ARGS);
+  });
+  std::thread class_deadline([&] {
+    int32_t current;
+
+    // led_getMaxCurrent is PIXY_PRIORITY_LOW //
+    expired_default = pixy.command("led_getMaxCurrent", END_OUT_ARGS, &current, END_IN_ARGS);
+  });
+
+  usleep(50000);
+
+  std::thread high([&] {
+    int32_t position;
+
+    pixy.command(PIXY_PRIORITY_HIGH, 0, "rcs_getPos", UINT8(0), END_OUT_ARGS, &position, END_IN_ARGS);
+    high_order = ++finished;
+  });
+
+  normal.join();
+  deadline.join();
+  class_deadline.join();
+  high.join();
+  CHECK(busy.get() == 0);
+
+  CHECK(high_order == 1 && normal_order == 2);
+  CHECK(expired == PIXY_ERROR_TIMEOUT);
+  CHECK(expired_default == PIXY_ERROR_TIMEOUT);
+
+  CHECK(pixy.set_command_deadline(PIXY_PRIORITY_LOW, 0) == 0);
+  CHECK(pixy.close() == 0);
+}
+
+// Getters posted together while the interpreter thread is held up go //
+// out as one pipelined batch. Each must get its own response back.    //
+static void test_pipelining(bool tags)
+{
+  PixyInterpreter          pixy;
+  std::vector<std::thread> callers;
+  int32_t                  results[7];
+  int32_t                  responses[7];
+  int32_t                  response;
+  int                      index;
+
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+  CHECK(pixy.set_response_tags(tags) == 0);
+
+  // Distinct values, so a response matched to the wrong call shows //
+  CHECK(pixy.send_command("cam_setBrightness", UINT8(41), END_OUT_ARGS, &response, END_IN_ARGS) >= 0);
+  CHECK(pixy.send_command("cam_setECV", UINT32(0x1234), END_OUT_ARGS, &response, END_IN_ARGS) >= 0);
+  CHECK(pixy.send_command("cam_setAWB", UINT8(0), END_OUT_ARGS, &response, END_IN_ARGS) >= 0);
+  CHECK(pixy.send_command("rcs_setPos", UINT8(0), UINT16(100), END_OUT_ARGS, &response, END_IN_ARGS) >= 0);
+  CHECK(pixy.send_command("rcs_setPos", UINT8(1), UINT16(200), END_OUT_ARGS, &response, END_IN_ARGS) >= 0);
+
+  CHECK(pixy.send_command_async([] { usleep(200000); return 0; }, PixyInterpreter::CommandCallback()) == 0);
+  usleep(50000);
+
+  for (index = 0; index != 7; ++index) {
+    responses[index] = -1;
+
+    callers.push_back(std::thread([&pixy, &results, &responses, index] {
+      switch (index) {
+        case 0:
+          results[index] = pixy.send_command("cam_getBrightness", END_OUT_ARGS, &responses[index], END_IN_ARGS);
+          break;
+        case 1:
+          results[index] = pixy.send_command("cam_getECV", END_OUT_ARGS, &responses[index], END_IN_ARGS);
+          break;
+        case 2:
+          results[index] = pixy.send_command("rcs_getPos", UINT8(0), END_OUT_ARGS, &responses[index], END_IN_ARGS);
+          break;
+        case 3:
+          results[index] = pixy.send_command("rcs_getPos", UINT8(1), END_OUT_ARGS, &responses[index], END_IN_ARGS);
+          break;
+        case 4:
+          results[index] = pixy.send_command("cam_getAWB", END_OUT_ARGS, &responses[index], END_IN_ARGS);
+          break;
+        case 5:
+          results[index] = pixy.send_command("cam_setBrightness", UINT8(41), END_OUT_ARGS, &responses[index], END_IN_ARGS);
+          break;
+        default:
+          results[index] = pixy.send_command("no_suchProc", END_OUT_ARGS, &responses[index], END_IN_ARGS);
+      }
+    }));
+  }
+
+  for (index = 0; index != 7; ++index) {
+    callers[index].join();
+  }
+
+  for (index = 0; index != 6; ++index) {
+    CHECK(results[index] >= 0);
+  }
+
+  CHECK(responses[0] == 41);
+  CHECK(responses[1] == 0x1234);
+  CHECK(responses[2] == 100);
+  CHECK(responses[3] == 200);
+  CHECK(responses[4] == 0);
+  CHECK(responses[5] == 0);
+  CHECK(results[6] == PIXY_ERROR_INVALID_COMMAND);
+
+  CHECK(pixy.close() == 0);
+}
+
+// Streamed trajectories, sent by the interpreter thread at the stream rate //
+static void test_servo_streaming()
+{
+  PixyHandle        pixy;
+  PixyServoWaypoint waypoints[2];
+  int               position;
+  int               stopped;
+
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+
+  // Reaches the target, passing through the positions between //
+  CHECK(pixy.rcs_set_position(0, 100) >= 0);
+  CHECK(pixy.rcs_move(0, 900, 400) == 0);
+  usleep(200000);
+  position = pixy.rcs_get_position(0);
+  CHECK(position > 100 && position < 900);
+  usleep(400000);
+  CHECK(pixy.rcs_get_position(0) == 900);
+
+  waypoints[0].time_ms  = 100;
+  waypoints[0].position = 500;
+  waypoints[1].time_ms  = 200;
+  waypoints[1].position = 300;
+  CHECK(pixy.rcs_stream(1, waypoints, 2) == 0);
+  usleep(400000);
+  CHECK(pixy.rcs_get_position(1) == 300);
+
+  // rcs_stop() leaves the servo where it is //
+  CHECK(pixy.rcs_set_position(0, 100) >= 0);
+  CHECK(pixy.rcs_move(0, 900, 1000) == 0);
+  usleep(200000);
+  CHECK(pixy.rcs_stop(0) == 0);
+  stopped = pixy.rcs_get_position(0);
+  CHECK(stopped > 100 && stopped < 900);
+  usleep(200000);
+  CHECK(pixy.rcs_get_position(0) == stopped);
+
+  // So does setting the position by hand //
+  CHECK(pixy.rcs_move(0, 900, 1000) == 0);
+  usleep(100000);
+  CHECK(pixy.rcs_set_position(0, 50) >= 0);
+  usleep(200000);
+  CHECK(pixy.rcs_get_position(0) == 50);
+
+  // Rates outside [1, 300] Hz and bad trajectories are rejected //
+  CHECK(pixy.rcs_set_stream_rate(0) == PIXY_ERROR_INVALID_PARAMETER);
+  CHECK(pixy.rcs_set_stream_rate(301) == PIXY_ERROR_INVALID_PARAMETER);
+  CHECK(pixy.rcs_set_stream_rate(1) == 0);
+  CHECK(pixy.rcs_set_stream_rate(300) == 0);
+  CHECK(pixy.rcs_set_stream_rate(50) == 0);
+  CHECK(pixy.rcs_move(PIXY_RCS_CHANNELS, 500, 100) == PIXY_ERROR_INVALID_PARAMETER);
+  CHECK(pixy.rcs_stream(0, waypoints, 0) == PIXY_ERROR_INVALID_PARAMETER);
+
+  CHECK(pixy.close() == 0);
+}
+
+static std::string read_file(const std::string & name)
+{
+  std::string contents;
+  FILE *      file;
+  char        chunk[4096];
+  size_t      length;
+
+  if ((file = fopen(name.c_str(), "rb")) != NULL) {
+    while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+      contents.append(chunk, length);
+    }
+    fclose(file);
+  }
+
+  return contents;
+}
+
+static void write_file(const std::string & name, const std::string & contents)
+{
+  FILE * file;
+
+  CHECK((file = fopen(name.c_str(), "wb")) != NULL);
+  if (file != NULL) {
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+  }
+}
+
+// Id the catalog 'contents' holds for procedure 'name', -1 if none //
+static int catalog_id(const std::string & contents, const std::string & name)
+{
+  size_t found;
+  size_t start;
+
+  found = contents.find("\t" + name + "\t");
+  if (found == std::string::npos) {
+    return -1;
+  }
+
+  start = contents.rfind('\n', found) + 1;
+
+  return atoi(contents.substr(start, found - start).c_str());
+}
+
+// The second connect to a firmware version takes its procedure ids //
+// from the catalog the first one wrote, and damaged catalogs are   //
+// never trusted.                                                   //
+static void test_procedure_catalog()
+{
+  // The emulator reports firmware 2.0.19 //
+  static const char * damaged[] = {
+    "",
+    "pixy-procs 1\n",
+    "pixy-procs 1\n3\tversion\t\t\n",
+    "pixy-procs 1\n3\tversion\t\t\nend 1",
+    "pixy-procs 1\n3\tversion\t\t\nend 2\n",
+    "pixy-procs 1\n3\tversion\t\t\nend 1\n4\tcam_getAWB\t\t\n",
+    "pixy-procs 2\n3\tversion\t\t\nend 1\n",
+    "pixy-procs 1\n3x\tversion\t\t\nend 1\n",
+    "pixy-procs 1\n\tversion\t\t\nend 1\n",
+    "pixy-procs 1\n3\t\t\t\nend 1\n",
+    "pixy-procs 1\n3\tversion\t0\t\nend 1\n",
+    "pixy-procs 1\n3\tversion\tzz\t\nend 1\n",
+    "pixy-procs 1\n3\tversion\t\t\t\nend 1\n",
+    "pixy-procs 1\n99999\tversion\t\t\nend 1\n",
+    "pixy-procs 1\n3\tversion\t\n"
+  };
+  static const char escaped[] =
+    "pixy-procs 1\n"
+    "7\ttab\\tnewline\\nbackslash\\\\\t0104a0\tcarriage\\rreturn\n"
+    "8\tplain\t\t\n"
+    "end 2\n";
+  PixyHandle  pixy;
+  ProcCatalog catalog;
+  char        directory[] = "/tmp/pixy-catalog-XXXXXX";
+  std::string file_name;
+  std::string contents;
+  std::string patched;
+  int         brightness_id;
+  int         calls_id;
+  size_t      found;
+  size_t      index;
+  int         brightness;
+
+  CHECK(mkdtemp(directory) != NULL);
+  PixyHandle::set_procedure_catalog(directory);
+  file_name = std::string(directory) + "/pixy-procs-2.0.19";
+
+  // First connect enumerates and records what it uses //
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+  CHECK(pixy.set_brightness(120) >= 0);
+  CHECK(pixy.get_brightness() == 120);
+  emulator_calls(pixy);
+  CHECK(pixy.close() == 0);
+
+  contents      = read_file(file_name);
+  brightness_id = catalog_id(contents, "cam_getBrightness");
+  calls_id      = catalog_id(contents, "emu_getCalls");
+  CHECK(contents.compare(0, 13, "pixy-procs 1\n") == 0);
+  CHECK(catalog_id(contents, "version") >= 0);
+  CHECK(brightness_id >= 0 && calls_id >= 0 && brightness_id != calls_id);
+  CHECK(catalog.load(2, 0, 19));
+
+  // Pointed at another procedure, only a catalog lookup calls it //
+  found = contents.find("\tcam_getBrightness\t");
+  if (found != std::string::npos) {
+    index   = contents.rfind('\n', found) + 1;
+    patched = contents.substr(0, index) + std::to_string(calls_id) + contents.substr(found);
+    write_file(file_name, patched);
+  }
+
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+  CHECK(pixy.set_brightness(120) >= 0);
+  brightness = pixy.get_brightness();
+  CHECK(brightness != 120);
+  CHECK(emulator_calls(pixy) == (uint32_t) brightness + 1);
+  CHECK(pixy.close() == 0);
+
+  // Nothing new was enumerated, so nothing was written //
+  CHECK(read_file(file_name) == patched);
+
+  // Escaped fields come back as they were, and are saved the same way //
+  write_file(std::string(directory) + "/pixy-procs-9.9.9", escaped);
+  CHECK(catalog.load(9, 9, 9));
+  CHECK(catalog.entries().size() == 2);
+  if (catalog.entries().size() == 2) {
+    CHECK(catalog.entries()[0].id == 7);
+    CHECK(catalog.entries()[0].name == "tab\tnewline\nbackslash\\");
+    CHECK(catalog.entries()[0].arg_types == std::string("\x01\x04\xa0"));
+    CHECK(catalog.entries()[0].info == "carriage\rreturn");
+    CHECK(catalog.entries()[1].id == 8 && catalog.entries()[1].name == "plain");
+  }
+  remove((std::string(directory) + "/pixy-procs-9.9.9").c_str());
+  CHECK(catalog.save(9, 9, 9));
+  CHECK(read_file(std::string(directory) + "/pixy-procs-9.9.9") == escaped);
+
+  // Truncated or damaged: nothing of it is used //
+  for (index = 0; index != sizeof(damaged) / sizeof(damaged[0]); ++index) {
+    write_file(std::string(directory) + "/pixy-procs-9.9.9", damaged[index]);
+    if (catalog.load(9, 9, 9) || !catalog.entries().empty()) {
+      fprintf(stderr, "catalog %u was not rejected\n", (unsigned int) index);
+      failures++;
+    }
+  }
+
+  remove((std::string(directory) + "/pixy-procs-9.9.9").c_str());
+  remove(file_name.c_str());
+  CHECK(rmdir(directory) == 0);
+  PixyHandle::set_procedure_catalog(NULL);
+}
+
+// The frame fd becomes readable when a frame arrives, and reading it //
+// clears it until the next one                                       //
+static void test_frame_fd()
+{
+  PixyHandle    pixy;
+  struct pollfd ready;
+  uint64_t      frames;
+
+  // Slow frames, so none arrives between the read and the check //
+  CHECK(pixy.init_emulated(SLOW_FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS) == 0);
+
+  ready.fd     = pixy.frame_fd();
+  ready.events = POLLIN;
+  CHECK(ready.fd >= 0);
+  CHECK(pixy.frame_fd() == ready.fd);
+
+  ready.revents = 0;
+  CHECK(poll(&ready, 1, WAIT_TIMEOUT) == 1);
+  CHECK(ready.revents & POLLIN);
+
+  frames = 0;
+  CHECK(read(ready.fd, &frames, sizeof(frames)) == sizeof(frames));
+  CHECK(frames >= 1);
+
+  ready.revents = 0;
+  CHECK(poll(&ready, 1, 0) == 0);
+  CHECK(read(ready.fd, &frames, sizeof(frames)) < 0 && errno == EAGAIN);
+
+  // And the next frame sets it again //
+  CHECK(poll(&ready, 1, WAIT_TIMEOUT) == 1);
+  CHECK(pixy.blocks_are_new() > 0);
+
+  CHECK(pixy.close() == 0);
+}
+
+// A frame callback can't close its own camera: the thread calling it //
+// is still inside the receiver, and can't join itself.               //
+static void test_close_from_callback(PixyThreading threading)
+{
+  PixyHandle       pixy;
+  std::atomic<int> result(1);
+  int              tries;
+
+  CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS, threading) == 0);
+
+  pixy.on_frame([&](const PixyFrameView &) {
+    if (result == 1) {
+      result = pixy.close();
+    }
+  });
+
+  for (tries = 0; tries != WAIT_TIMEOUT / 10 && result == 1; ++tries) {
+    if (threading == PIXY_THREAD_NONE) {
+      pixy.service(10);
+    } else {
+      usleep(10000);
+    }
+  }
+
+  CHECK(result == PIXY_ERROR_IN_CALLBACK);
+
+  // Still open //
+  pixy.on_frame(PixyHandle::FrameCallback());
+  CHECK(pixy.rcs_set_position(0, 300) >= 0);
+  CHECK(pixy.rcs_get_position(0) == 300);
+  CHECK(pixy.close() == 0);
+}
+
+int main()
+{
+  PixyThreading threadings[] = { PIXY_THREAD_DEDICATED, PIXY_THREAD_NONE };
+  int           index;
+  int           tries;
+
+  for (index = 0; index != 2; ++index) {
+    PixyHandle pixy;
+
+    CHECK(pixy.init_emulated(FRAME_RATE, NORMAL_BLOCKS, COLOR_CODE_BLOCKS, threadings[index]) == 0);
+
+    if (threadings[index] == PIXY_THREAD_NONE) {
+      // Inline: commands run on this thread, frames arrive as it services //
+      test_commands(pixy);
+      for (tries = 0; tries != WAIT_TIMEOUT / 10 && pixy.blocks_are_new() == 0; ++tries) {
+        pixy.service(10);
+      }
+      CHECK(pixy.blocks_are_new() > 0);
+    } else {
+      test_blocks(pixy);
+      test_commands(pixy);
+    }
+
+    pixy.close();
+  }
+
+  test_open_all();
+  test_coalescing(PIXY_THREAD_NONE);
+  test_coalescing(PIXY_THREAD_DEDICATED);
+  test_settings_cache();
+  test_priorities();
+  test_pipelining(false);
+  test_pipelining(true);
+  test_servo_streaming();
+  test_procedure_catalog();
+  test_frame_fd();
+  test_close_from_callback(PIXY_THREAD_DEDICATED);
+  test_close_from_callback(PIXY_THREAD_NONE);
+
+  if (failures) {
+    fprintf(stderr, "emulator_test: %d checks failed\n", failures);
+    return EXIT_FAILURE;
+  }
+
+  fprintf(stderr, "emulator_test: passed\n");
+  return EXIT_SUCCESS;
+}